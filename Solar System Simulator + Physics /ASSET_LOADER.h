@@ -0,0 +1,202 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <cstring>
+#include <algorithm>
+
+#include "glad/glad.h"
+
+#include "THREAD_POOL.h"
+
+//Image with its whole mip chain packed back to back, level 0 first.
+//RGBA8 unless 'format' says it is block-compressed, either owned in 'pixels' or
+//borrowed from a mapping that 'backing' keeps alive
+struct DecodedImage{
+
+    int width = 0, height = 0;
+    GLenum format = GL_RGBA8;
+    std::vector<unsigned char> pixels;
+
+    std::shared_ptr<const void> backing;
+    const unsigned char* borrowed = nullptr;
+    size_t borrowedSize = 0;
+
+    //where every level starts inside the data, its byte size and dimensions
+    std::vector<size_t> levelOffsets, levelSizes;
+    std::vector<int> levelWidths, levelHeights;
+
+    int levels() const {
+        return (int)levelOffsets.size();
+    }
+
+    bool compressed() const {
+        return format != GL_RGBA8;
+    }
+
+    const unsigned char* data() const {
+        return borrowed ? borrowed : pixels.data();
+    }
+
+    size_t size() const {
+        return borrowed ? borrowedSize : pixels.size();
+    }
+};
+
+//fills in levels 1..n of an image whose level 0 is already in 'pixels', 2x2 box filter down to 1x1
+inline void buildMipChain(DecodedImage& image){
+
+    image.levelOffsets.assign(1, 0);
+    image.levelSizes.assign(1, (size_t)image.width * image.height * 4);
+    image.levelWidths.assign(1, image.width);
+    image.levelHeights.assign(1, image.height);
+
+    int width = image.width, height = image.height;
+    size_t total = image.levelSizes[0];
+    while(width > 1 || height > 1){
+        width = std::max(width / 2, 1);
+        height = std::max(height / 2, 1);
+        image.levelOffsets.push_back(total);
+        image.levelSizes.push_back((size_t)width * height * 4);
+        image.levelWidths.push_back(width);
+        image.levelHeights.push_back(height);
+        total += image.levelSizes.back();
+    }
+    image.pixels.resize(total);
+
+    for(int level = 1; level < image.levels(); level++){
+
+        const unsigned char* src = image.pixels.data() + image.levelOffsets[level - 1];
+        unsigned char* dst = image.pixels.data() + image.levelOffsets[level];
+        int srcWidth = image.levelWidths[level - 1], srcHeight = image.levelHeights[level - 1];
+        int dstWidth = image.levelWidths[level], dstHeight = image.levelHeights[level];
+
+        for(int y = 0; y < dstHeight; y++){
+            int y0 = std::min(y * 2, srcHeight - 1), y1 = std::min(y * 2 + 1, srcHeight - 1);
+            for(int x = 0; x < dstWidth; x++){
+                int x0 = std::min(x * 2, srcWidth - 1), x1 = std::min(x * 2 + 1, srcWidth - 1);
+                for(int c = 0; c < 4; c++){
+                    int sum = src[((size_t)y0 * srcWidth + x0) * 4 + c] + src[((size_t)y0 * srcWidth + x1) * 4 + c]
+                            + src[((size_t)y1 * srcWidth + x0) * 4 + c] + src[((size_t)y1 * srcWidth + x1) * 4 + c];
+                    dst[((size_t)y * dstWidth + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+    }
+}
+
+//Decodes images off the GL thread and streams them to the GPU through a pixel unpack buffer.
+//load() queues 'decode' as a background task on the worker pool; once it has produced the image,
+//pump() (GL thread, once per frame) copies it into the PBO and calls 'upload' with the PBO bound,
+//passing the PBO-relative address of the pixels so glTexSubImage* sources straight from the buffer.
+//Whatever uses the texture shows a placeholder until its upload has run.
+class AssetLoader{
+
+    public:
+
+        typedef std::function<void(DecodedImage&)> DecodeFunction;
+        typedef std::function<void(const DecodedImage&, const unsigned char* pixels)> UploadFunction;
+
+        void load(DecodeFunction decode, UploadFunction upload){
+
+            outstanding++;
+            auto job = std::make_shared<Job>();
+            job->upload = std::move(upload);
+
+            //the task holds on to the queue, not the loader: decodes still running at exit outlive it
+            std::shared_ptr<Finished> target = finished;
+            workerPool().submitBackground([target, job, decode]{
+                decode(job->image);
+                std::lock_guard<std::mutex> lock(target->mutex);
+                target->jobs.push_back(job);
+            });
+        }
+
+        //uploads finished images, at least one and then more while under 'byteBudget', so a burst of
+        //arrivals is spread over a few frames instead of one long hitch
+        void pump(size_t byteBudget = UPLOAD_BUDGET){
+
+            size_t uploaded = 0;
+            while(true){
+
+                std::shared_ptr<Job> job;
+                {
+                    std::lock_guard<std::mutex> lock(finished->mutex);
+                    auto &jobs = finished->jobs;
+                    if(jobs.empty())
+                        break;
+                    if(uploaded > 0 && uploaded + jobs.front()->image.size() > byteBudget)
+                        break;
+                    job = jobs.front();
+                    jobs.pop_front();
+                }
+
+                const DecodedImage& image = job->image;
+                size_t size = image.size();
+
+                if(PBO == 0)
+                    glGenBuffers(1, &PBO);
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, PBO);
+
+                //fresh storage every time, the driver keeps the previous one alive until its copy is done
+                glBufferData(GL_PIXEL_UNPACK_BUFFER, size, nullptr, GL_STREAM_DRAW);
+                void* mapped = size > 0 ? glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT) : nullptr;
+
+                if(mapped){
+                    std::memcpy(mapped, image.data(), size);
+                    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+                    //offsets into the bound PBO
+                    job->upload(image, (const unsigned char*)nullptr);
+                }
+                else{
+                    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                    job->upload(image, image.data());
+                }
+
+                glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+                uploaded += size;
+                outstanding--;
+            }
+        }
+
+        //images queued or decoded but not uploaded yet
+        int inFlight() const {
+            return outstanding.load();
+        }
+
+    private:
+
+        struct Job{
+
+            DecodedImage image;
+            UploadFunction upload;
+        };
+
+        //enough for a couple of 2048x1024 layers with their mips per frame
+        static const size_t UPLOAD_BUDGET = 24u << 20;
+
+        //decoded, waiting for pump()
+        struct Finished{
+
+            std::mutex mutex;
+            std::deque<std::shared_ptr<Job>> jobs;
+        };
+
+        std::shared_ptr<Finished> finished = std::make_shared<Finished>();
+        std::atomic<int> outstanding{0};
+
+        unsigned int PBO = 0;
+};
+
+//process-wide loader; decoding runs on workerPool(), uploads on whichever thread calls pump()
+inline AssetLoader& assetLoader(){
+    static AssetLoader loader;
+    return loader;
+}
+
+#endif
@@ -8,6 +8,7 @@
 #include <sstream>
 #include <map>
 #include <vector>
+#include <utility>
 
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
@@ -17,17 +18,20 @@
 #include <assimp/postprocess.h>
 
 #include "SHADER.h"
+#include "ASSET_LOADER.h"
+#include "MESH_CACHE.h"
+#include "VERTEX_FORMAT.h"
 
 
 unsigned int TextureFromFile(const char *path, const std::string &directory, bool gamma = false);
 
+//what the vertex buffer holds, 20 bytes: the normal octahedral-encoded in two snorm16s,
+//texture coordinates as half floats (they may tile past 1). Tangents aren't kept, no shader reads them
 struct Vertex{
 
     glm::vec3 Position;
-    glm::vec3 Normal;
-    glm::vec3 Tangent;
-    glm::vec3 Bitangent;
-    glm::vec2 TexCoords;
+    int16_t Normal[2];
+    uint16_t TexCoords[2];
 };
 
 struct Texture{
@@ -41,39 +45,48 @@ class Mesh{
 
     public:
 
-        //Mesh data
+        //Mesh data, the CPU copies are empty once releaseGeometry() has run.
+        //Indices are in 'shortIndices' when the vertex count allows 16 bits, in 'indices' otherwise
         std::vector<Vertex> vertices;
         std::vector<unsigned int> indices;
+        std::vector<unsigned short> shortIndices;
         std::vector<Texture> texture;
 
-        Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<Texture> texture){
+        //takes the arrays over, pass them with std::move so they are never copied
+        Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices, std::vector<unsigned short> shortIndices, std::vector<Texture> texture)
+            : vertices(std::move(vertices)), indices(std::move(indices)), shortIndices(std::move(shortIndices)), texture(std::move(texture)){
 
-            this->vertices = vertices;
-            this->indices = indices;
-            this->texture = texture;
+            if(this->shortIndices.empty())
+                setupMesh(this->vertices.data(), this->vertices.size(), this->indices.data(), GL_UNSIGNED_INT, this->indices.size());
+            else
+                setupMesh(this->vertices.data(), this->vertices.size(), this->shortIndices.data(), GL_UNSIGNED_SHORT, this->shortIndices.size());
 
-            setupMesh();
+        }
+
+        //straight from arrays the mesh doesn't keep, e.g. a mapped cache entry
+        Mesh(const Vertex* vertices, size_t vertexCount, const void* indices, GLenum indexType, size_t indexCount, std::vector<Texture> texture)
+            : texture(std::move(texture)){
 
+            setupMesh(vertices, vertexCount, indices, indexType, indexCount);
+        }
+
+        //the GPU has its own copy, drawing only needs the buffers
+        void releaseGeometry(){
+            std::vector<Vertex>().swap(vertices);
+            std::vector<unsigned int>().swap(indices);
+            std::vector<unsigned short>().swap(shortIndices);
         }
 
         void Draw(Shader &shader){
 
-            unsigned int diffuseNr = 1;
-            unsigned int specularNr = 1;
+            //sampler names only depend on the texture list, resolve them again only when the program changes
+            if(samplerProgram != shader.ID)
+                resolveSamplers(shader);
 
             for(unsigned int i = 0; i<texture.size(); i++){
 
                 glActiveTexture(GL_TEXTURE0 + i);
-                
-                std::string number;
-                std::string name = texture[i].type;
-
-                if(name == "texture_diffuse")
-                    number = std::to_string(diffuseNr++);
-                else if (name == "texture_specular")
-                    number = std::to_string(specularNr++);
-            
-                shader.setInt(("material." + name + number).c_str(), i);
+                shader.set(samplers[i], (int)i);
                 glBindTexture(GL_TEXTURE_2D, texture[i].id);
             }
         
@@ -81,7 +94,7 @@ class Mesh{
 
             //draw mesh
             glBindVertexArray(VAO);
-            glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
+            glDrawElements(GL_TRIANGLES, indexCount, indexType, 0);
             glBindVertexArray(0);
         
         }
@@ -89,8 +102,38 @@ class Mesh{
     private:
         //render data
         unsigned int VAO, VBO, EBO;
+        unsigned int indexCount = 0;
+        GLenum indexType = GL_UNSIGNED_INT;
+
+        //"material.texture_diffuse1", ... for each texture, in the program below
+        std::vector<Uniform<int>> samplers;
+        unsigned int samplerProgram = 0;
+
+        void resolveSamplers(Shader &shader){
+
+            unsigned int diffuseNr = 1;
+            unsigned int specularNr = 1;
+
+            samplers.clear();
+            for(unsigned int i = 0; i<texture.size(); i++){
+
+                std::string number;
+                std::string name = texture[i].type;
+
+                if(name == "texture_diffuse")
+                    number = std::to_string(diffuseNr++);
+                else if (name == "texture_specular")
+                    number = std::to_string(specularNr++);
+
+                samplers.push_back(shader.uniform<int>("material." + name + number));
+            }
+            samplerProgram = shader.ID;
+        }
 
-        void setupMesh(){
+        void setupMesh(const Vertex* vertices, size_t vertexCount, const void* indices, GLenum indexType, size_t indexCount){
+
+            this->indexCount = (unsigned int)indexCount;
+            this->indexType = indexType;
 
             glGenVertexArrays(1, &VAO);
             glGenBuffers(1, &VBO);
@@ -99,23 +142,23 @@ class Mesh{
             glBindVertexArray(VAO);
             glBindBuffer(GL_ARRAY_BUFFER, VBO);
 
-            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0], GL_STATIC_DRAW);
+            glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(Vertex), vertices, GL_STATIC_DRAW);
 
             glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), &indices[0], GL_STATIC_DRAW);
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * indexSize(indexType), indices, GL_STATIC_DRAW);
 
         
             //vertex position
             glEnableVertexAttribArray(0);
             glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)0);
 
-            //vertex normal
+            //vertex normal, octahedral, decoded in the shader
             glEnableVertexAttribArray(1);
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
+            glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(Vertex), (void*)offsetof(Vertex, Normal));
 
             //vertex texture
             glEnableVertexAttribArray(2);
-            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
+            glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, TexCoords));
         
             glBindVertexArray(0);
         }
@@ -145,6 +188,23 @@ class Model{
         std::vector<Texture> textures_loaded; //stores all the textures loaded so far, optimization to make sure textures aren't loaded more than once
         
         void loadModel(std::string path){
+
+            directory =  path.substr(0, path.find_last_of('/'));
+
+            //a cached import is mapped and uploaded as is
+            CachedModel cached;
+            if(loadCachedModel(path, sizeof(Vertex), cached)){
+                meshes.reserve(cached.meshes.size());
+                for(const auto &mesh: cached.meshes){
+                    std::vector<Texture> textures;
+                    textures.reserve(mesh.textures.size());
+                    for(const auto &texture: mesh.textures)
+                        textures.push_back(loadTexture(texture.path, texture.type));
+                    meshes.emplace_back((const Vertex*)mesh.vertices, mesh.vertexCount, mesh.indices,
+                                        mesh.indexSize == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT, mesh.indexCount, std::move(textures));
+                }
+                return;
+            }
             
             Assimp::Importer import;
             
@@ -156,9 +216,29 @@ class Model{
                 return;
             }
 
-            directory =  path.substr(0, path.find_last_of('/'));
-
+            //a mesh referenced by several nodes is added once per node, this is the common case
+            meshes.reserve(scene->mNumMeshes);
             processNode(scene->mRootNode, scene);
+
+            //everything is in the meshes now, don't hold the scene through the cache write
+            import.FreeScene();
+
+            //next start skips the import
+            std::vector<CachedMesh> entry(meshes.size());
+            for(size_t i = 0; i < meshes.size(); i++){
+                entry[i].vertices = (const unsigned char*)meshes[i].vertices.data();
+                entry[i].vertexCount = (uint32_t)meshes[i].vertices.size();
+                bool narrow = !meshes[i].shortIndices.empty();
+                entry[i].indices = narrow ? (const void*)meshes[i].shortIndices.data() : (const void*)meshes[i].indices.data();
+                entry[i].indexCount = (uint32_t)(narrow ? meshes[i].shortIndices.size() : meshes[i].indices.size());
+                entry[i].indexSize = narrow ? 2 : 4;
+                for(const auto &texture: meshes[i].texture)
+                    entry[i].textures.push_back(CachedTexture{texture.type, texture.path});
+            }
+            storeCachedModel(path, sizeof(Vertex), entry);
+
+            for(auto &mesh: meshes)
+                mesh.releaseGeometry();
     
         }
         void processNode(aiNode *node, const aiScene *scene){
@@ -179,56 +259,40 @@ class Model{
             //data to fill
             std::vector<Vertex> vertices;
             std::vector<unsigned int> indices;
+            std::vector<unsigned short> shortIndices;
             std::vector<Texture> textures;
+
+            //sized once, triangulated faces have three indices each
+            bool narrow = indexTypeFor(mesh->mNumVertices) == GL_UNSIGNED_SHORT;
+            vertices.reserve(mesh->mNumVertices);
+            if(narrow)
+                shortIndices.reserve((size_t)mesh->mNumFaces * 3);
+            else
+                indices.reserve((size_t)mesh->mNumFaces * 3);
+
             //walk through each of of the mesh vertices
             for(unsigned int i = 0; i < mesh->mNumVertices; i++){
                 
                 Vertex vertex;
 
-                glm::vec3 vector;
-                vector.x = mesh->mVertices[i].x;
-                vector.y = mesh->mVertices[i].y;
-                vector.z = mesh->mVertices[i].z;
-                vertex.Position = vector;
+                vertex.Position = glm::vec3(mesh->mVertices[i].x, mesh->mVertices[i].y, mesh->mVertices[i].z);
                 
                 //normals
-                if(mesh->HasNormals()){
-
-                    vector.x = mesh->mNormals[i].x;
-                    vector.y = mesh->mNormals[i].y;
-                    vector.z = mesh->mNormals[i].z;
-                    vertex.Normal = vector;
-                }
+                glm::vec3 normal(0.0f, 0.0f, 1.0f);
+                if(mesh->HasNormals())
+                    normal = glm::vec3(mesh->mNormals[i].x, mesh->mNormals[i].y, mesh->mNormals[i].z);
+                packOctahedral(normal, vertex.Normal);
 
                 //texture coordinates
-
+                glm::vec2 texCoords(0.0f, 0.0f);
                 if(mesh->mTextureCoords[0]) //does the mesh contains texture coordinates?
                 {
-                    glm::vec3 vec;
-
                     //a vertex can contain up to 8 different texture coordinates. We thus make the assumption that we won't 
                     //use models where a vertex can have multiple texture coordinates so we always take the first set (0).
-                    vec.x = mesh->mTextureCoords[0][i].x;
-                    vec.y = mesh->mTextureCoords[0][i].y;
-                    vertex.TexCoords = vec;
-                    
-                    if(mesh->HasTangentsAndBitangents()){
-                    
-                        //tangent
-                        vector.x = mesh->mTangents[i].x;
-                        vector.y = mesh->mTangents[i].y;
-                        vector.z = mesh->mTangents[i].z;
-                        vertex.Tangent = vector;
-
-                        //bitangen
-                        vector.x = mesh->mBitangents[i].x;
-                        vector.y = mesh->mBitangents[i].y;
-                        vector.z = mesh->mBitangents[i].z;
-                        vertex.Bitangent = vector;
-                    }
+                    texCoords = glm::vec2(mesh->mTextureCoords[0][i].x, mesh->mTextureCoords[0][i].y);
                 }
-                else
-                    vertex.TexCoords = glm::vec2(0.0f, 0.0f);
+                vertex.TexCoords[0] = packHalf(texCoords.x);
+                vertex.TexCoords[1] = packHalf(texCoords.y);
 
                 vertices.push_back(vertex);
                 
@@ -236,10 +300,13 @@ class Model{
             }
             //now walk through eacg of the mesh's faces (a face is a mesh its triangle ) and retrieve the corresponding vertex indices
             for(unsigned int i = 0; i<mesh->mNumFaces; i++){
-                aiFace face = mesh->mFaces[i];
+                const aiFace& face = mesh->mFaces[i];
                 //retrieve all indices of the face and store them in the indices vector
                 for(unsigned int j = 0; j<face.mNumIndices; j++){
-                    indices.push_back(face.mIndices[j]);
+                    if(narrow)
+                        shortIndices.push_back((unsigned short)face.mIndices[j]);
+                    else
+                        indices.push_back(face.mIndices[j]);
                 }
             }
             
@@ -252,88 +319,90 @@ class Model{
             // specular: texture_specularN
             // normal: texture_normalN
         
+            textures.reserve(material->GetTextureCount(aiTextureType_DIFFUSE) + material->GetTextureCount(aiTextureType_SPECULAR) +
+                             material->GetTextureCount(aiTextureType_HEIGHT) + material->GetTextureCount(aiTextureType_AMBIENT));
             // 1. Diffuse maps
-            std::vector<Texture> diffuseMaps = loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse");
-            textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+            loadMaterialTextures(material, aiTextureType_DIFFUSE, "texture_diffuse", textures);
             // 2. Specular maps
-            std::vector<Texture> specularMaps = loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular");
-            textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+            loadMaterialTextures(material, aiTextureType_SPECULAR, "texture_specular", textures);
             // 3. Normal maps
-            std::vector<Texture> normalMaps = loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal");
-            textures.insert(textures.end(), normalMaps.begin(), normalMaps.end());
+            loadMaterialTextures(material, aiTextureType_HEIGHT, "texture_normal", textures);
             // 4. Height maps
-            std::vector<Texture> heightMaps = loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height");
-            textures.insert(textures.end(), heightMaps.begin(), heightMaps.end());
+            loadMaterialTextures(material, aiTextureType_AMBIENT, "texture_height", textures);
             
-            //return a mesh object created from the extracted mesh data
-            return Mesh(vertices, indices, textures);
+            //return a mesh object created from the extracted mesh data, the arrays move into it
+            return Mesh(std::move(vertices), std::move(indices), std::move(shortIndices), std::move(textures));
             
         }
-        std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type, std::string typeName){
+        //appends the material's textures of one type to 'textures'
+        void loadMaterialTextures(aiMaterial *mat, aiTextureType type, const std::string& typeName, std::vector<Texture>& textures){
 
-            std::vector<Texture> textures;
             for(unsigned int i = 0; i < mat->GetTextureCount(type); i++){
                 aiString str;
                 mat->GetTexture(type, i, &str);
-                //check if texture was loaded before and if so, continue to next iteration: skip loading a new texture
-                bool skip = false;
-                for(unsigned int j = 0; j < textures_loaded.size(); j++){
-                    if(std::strcmp(textures_loaded[j].path.data(), str.C_Str()) == 0){
-                        textures.push_back(textures_loaded[j]);
-                        skip = true;
-                        break;
-                    }
-                }
-                if(!skip){
-                    //if texture hasn't been loaded already, load it
-                    Texture texture;
-                    texture.id = TextureFromFile(str.C_Str(), this->directory);
-                    texture.type = typeName;
-                    texture.path = str.C_Str();
-                    textures.push_back(texture);
-                    textures_loaded.push_back(texture);  //store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
-                }
+                textures.push_back(loadTexture(str.C_Str(), typeName));
+            }
+        }
+        Texture loadTexture(const std::string& path, const std::string& typeName){
 
+            //check if texture was loaded before and if so, skip loading a new texture
+            for(unsigned int j = 0; j < textures_loaded.size(); j++){
+                if(textures_loaded[j].path == path)
+                    return textures_loaded[j];
             }
-            return textures;
+            //if texture hasn't been loaded already, load it
+            Texture texture;
+            texture.id = TextureFromFile(path.c_str(), this->directory);
+            texture.type = typeName;
+            texture.path = path;
+            textures_loaded.push_back(texture);  //store it as texture loaded for entire model, to ensure we won't unnecesery load duplicate textures.
+            return texture;
         }
 };
 
+//returns right away with a 1x1 grey placeholder, the image is decoded on a worker and
+//replaces it once assetLoader().pump() has uploaded it
 unsigned int TextureFromFile(const char* path, const std::string &directory, bool gamma){
     std::string filename = std::string(path);
     filename = directory + '/' + filename;
 
     unsigned int textureID;
     glGenTextures(1, &textureID);
-    
-    int width, height, nrComponents;
-
-    unsigned char* data = stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-    if(data){
-        GLenum format;
-        if (nrComponents == 1)
-            format = GL_RED;
-        else if (nrComponents == 3)
-            format = GL_RGB;
-        else if (nrComponents == 4)
-            format = GL_RGBA;
-
-        glBindTexture(GL_TEXTURE_2D, textureID);
-        glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
-        
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        
-        stbi_image_free(data);
-    }
-    else{
-        std::cout << "Texture failed to load at path: " << path << std::endl;
-        stbi_image_free(data);
-    }
-    
+
+    const unsigned char placeholder[4] = {128, 128, 128, 255};
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, placeholder);
+
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    assetLoader().load(
+        [filename](DecodedImage& image){
+            int nrComponents;
+            unsigned char* data = stbi_load(filename.c_str(), &image.width, &image.height, &nrComponents, 4);
+            if(!data){
+                std::cout << "Texture failed to load at path: " << filename << std::endl;
+                image.width = image.height = 0;
+                return;
+            }
+            image.pixels.assign(data, data + (size_t)image.width * image.height * 4);
+            stbi_image_free(data);
+            buildMipChain(image);
+        },
+        [textureID](const DecodedImage& image, const unsigned char* pixels){
+            //a failed load keeps the placeholder
+            if(image.levels() == 0)
+                return;
+            glBindTexture(GL_TEXTURE_2D, textureID);
+            for(int level = 0; level < image.levels(); level++)
+                glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, image.levelWidths[level], image.levelHeights[level], 0,
+                             GL_RGBA, GL_UNSIGNED_BYTE, pixels + image.levelOffsets[level]);
+            glBindTexture(GL_TEXTURE_2D, 0);
+        });
+
     return textureID;
 }
 
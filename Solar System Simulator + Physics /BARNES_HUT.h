@@ -0,0 +1,299 @@
+#ifndef BARNES_HUT_H
+#define BARNES_HUT_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+#include <glm/glm.hpp>
+
+#include "PHYSICS.h"
+#include "THREAD_POOL.h"
+
+//Barnes-Hut octree solver, O(N log M) instead of O(N*M).
+//The tree is built over the massive bodies only, test particles just walk it.
+//theta is the opening angle: a cell of size s at distance d is treated as a point mass when s/d < theta.
+//0 degenerates into the direct sum, 0.5 is the usual accuracy/speed trade-off, ~1 is fast and rough.
+//Each walk only collects an interaction list (leaf bodies and accepted cells), the list is then
+//summed by the same SIMD kernel the direct solver uses.
+class BarnesHutSolver: public GravitySolver{
+
+    public:
+
+        float theta;
+        //cells holding this many sources or fewer become leaves and are summed directly
+        int leafSize;
+
+        BarnesHutSolver(float theta = 0.5f, int leafSize = 8):theta(theta), leafSize(leafSize){}
+
+        void computeAccelerations(BodyTable& bodies, const std::vector<int>& sources, float G, float softening) override{
+
+            buildTree(bodies, sources, G);
+
+            const float eps2 = softening * softening;
+            const int count = (int)bodies.size();
+
+            //the tree is read-only from here on, so every chunk walks it independently with its own scratch lists
+            workerPool().parallelFor(0, count, WALK_CHUNK, [&](int begin, int end){
+                Walk walk;
+                for(int i = begin; i < end; i++){
+                    glm::vec3 acc = accelerationAt(local(bodies, i), eps2, walk);
+                    bodies.ax[i] = acc.x;
+                    bodies.ay[i] = acc.y;
+                    bodies.az[i] = acc.z;
+                }
+            });
+        }
+
+        void computeAccelerations(BodyTable& bodies, const std::vector<int>& sources, const std::vector<int>& targets, float G, float softening) override{
+
+            buildTree(bodies, sources, G);
+
+            const float eps2 = softening * softening;
+            const int count = (int)targets.size();
+
+            workerPool().parallelFor(0, count, WALK_CHUNK, [&](int begin, int end){
+                Walk walk;
+                for(int t = begin; t < end; t++){
+                    int i = targets[t];
+                    glm::vec3 acc = accelerationAt(local(bodies, i), eps2, walk);
+                    bodies.ax[i] = acc.x;
+                    bodies.ay[i] = acc.y;
+                    bodies.az[i] = acc.z;
+                }
+            });
+        }
+
+    private:
+
+        struct Node{
+
+            glm::vec3 center;
+            float halfSize;
+
+            glm::vec3 centerOfMass;
+            float GM;
+
+            //children are indices into 'nodes', -1 when that octant is empty
+            int children[8];
+            //range in the sorted source arrays covered by this cell
+            int begin, end;
+            bool leaf;
+        };
+
+        std::vector<Node> nodes;
+
+        //sources reordered so every cell covers a contiguous range
+        std::vector<glm::vec3> sourcePos;
+        std::vector<float> sourceGM;
+        std::vector<int> order;
+        std::vector<int> scratch;
+
+        //world position the tree coordinates are measured from
+        glm::dvec3 origin = glm::dvec3(0.0);
+
+        glm::vec3 local(const BodyTable& bodies, int i) const {
+            return glm::vec3(bodies.position(i) - origin);
+        }
+
+        //per-task traversal state
+        struct Walk{
+
+            std::vector<int> stack;
+            std::vector<float> listX, listY, listZ, listGM;
+
+            void addInteraction(const glm::vec3& p, float GM){
+                listX.push_back(p.x);
+                listY.push_back(p.y);
+                listZ.push_back(p.z);
+                listGM.push_back(GM);
+            }
+        };
+
+        //tree walks are much heavier than a direct-sum row, so fewer bodies per task
+        static const int WALK_CHUNK = 256;
+
+        //identical positions would otherwise split forever
+        static const int MAX_DEPTH = 32;
+
+        void buildTree(const BodyTable& bodies, const std::vector<int>& sources, float G){
+
+            nodes.clear();
+            const int count = (int)sources.size();
+            if(count == 0)
+                return;
+
+            //the tree lives in float around the first source, close enough to everything that matters
+            origin = bodies.position(sources[0]);
+
+            glm::vec3 lo = local(bodies, sources[0]);
+            glm::vec3 hi = lo;
+            for(int s = 0; s < count; s++){
+                glm::vec3 p = local(bodies, sources[s]);
+                lo = glm::vec3(std::min(lo.x, p.x), std::min(lo.y, p.y), std::min(lo.z, p.z));
+                hi = glm::vec3(std::max(hi.x, p.x), std::max(hi.y, p.y), std::max(hi.z, p.z));
+            }
+
+            glm::vec3 extent = hi - lo;
+            float halfSize = 0.5f * std::max(extent.x, std::max(extent.y, extent.z));
+            //pad a little so bodies on the boundary land inside
+            halfSize = halfSize * 1.001f + 1e-3f;
+
+            order.resize(count);
+            scratch.resize(count);
+            for(int s = 0; s < count; s++)
+                order[s] = sources[s];
+
+            nodes.reserve(2 * count / std::max(leafSize, 1) + 8);
+            build(bodies, 0, count, (lo + hi) * 0.5f, halfSize, 0);
+
+            //copy the sources in tree order so leaf sums stream contiguous memory
+            sourcePos.resize(count);
+            sourceGM.resize(count);
+            for(int s = 0; s < count; s++){
+                sourcePos[s] = local(bodies, order[s]);
+                sourceGM[s] = G * bodies.mass[order[s]];
+            }
+            computeMoments(0);
+        }
+
+        //splits order[begin, end) into octants, returns the index of the new node
+        int build(const BodyTable& bodies, int begin, int end, glm::vec3 center, float halfSize, int depth){
+
+            int index = (int)nodes.size();
+            nodes.push_back(Node());
+
+            Node node;
+            node.center = center;
+            node.halfSize = halfSize;
+            node.centerOfMass = center;
+            node.GM = 0.0f;
+            node.begin = begin;
+            node.end = end;
+            node.leaf = (end - begin) <= leafSize || depth >= MAX_DEPTH;
+            for(int c = 0; c < 8; c++)
+                node.children[c] = -1;
+
+            if(node.leaf){
+                nodes[index] = node;
+                return index;
+            }
+
+            //counting sort of the range by octant
+            int counts[8] = {0};
+            for(int i = begin; i < end; i++)
+                counts[octant(local(bodies, order[i]), center)]++;
+
+            int starts[9];
+            starts[0] = begin;
+            for(int c = 0; c < 8; c++)
+                starts[c + 1] = starts[c] + counts[c];
+
+            int fill[8];
+            for(int c = 0; c < 8; c++)
+                fill[c] = starts[c];
+            for(int i = begin; i < end; i++)
+                scratch[fill[octant(local(bodies, order[i]), center)]++] = order[i];
+            std::copy(scratch.begin() + begin, scratch.begin() + end, order.begin() + begin);
+
+            float childHalf = halfSize * 0.5f;
+            for(int c = 0; c < 8; c++){
+                if(counts[c] == 0)
+                    continue;
+
+                glm::vec3 offset((c & 1) ? childHalf : -childHalf,
+                                 (c & 2) ? childHalf : -childHalf,
+                                 (c & 4) ? childHalf : -childHalf);
+                node.children[c] = build(bodies, starts[c], starts[c + 1], center + offset, childHalf, depth + 1);
+            }
+
+            nodes[index] = node;
+            return index;
+        }
+
+        static int octant(const glm::vec3& p, const glm::vec3& center){
+            return (p.x >= center.x ? 1 : 0) | (p.y >= center.y ? 2 : 0) | (p.z >= center.z ? 4 : 0);
+        }
+
+        //bottom-up mass and center of mass
+        void computeMoments(int index){
+
+            Node& node = nodes[index];
+            float GM = 0.0f;
+            glm::vec3 weighted(0.0f);
+
+            if(node.leaf){
+                for(int i = node.begin; i < node.end; i++){
+                    GM += sourceGM[i];
+                    weighted += sourcePos[i] * sourceGM[i];
+                }
+            }
+            else{
+                for(int c = 0; c < 8; c++){
+                    int child = node.children[c];
+                    if(child < 0)
+                        continue;
+                    computeMoments(child);
+                    GM += nodes[child].GM;
+                    weighted += nodes[child].centerOfMass * nodes[child].GM;
+                }
+            }
+
+            node.GM = GM;
+            node.centerOfMass = GM > 0.0f ? weighted / GM : node.center;
+        }
+
+        glm::vec3 accelerationAt(const glm::vec3& position, float eps2, Walk& walk){
+
+            if(nodes.empty())
+                return glm::vec3(0.0f);
+
+            const float theta2 = theta * theta;
+
+            walk.listX.clear();
+            walk.listY.clear();
+            walk.listZ.clear();
+            walk.listGM.clear();
+
+            walk.stack.clear();
+            walk.stack.push_back(0);
+            while(!walk.stack.empty()){
+
+                const Node& node = nodes[walk.stack.back()];
+                walk.stack.pop_back();
+
+                glm::vec3 d = node.centerOfMass - position;
+                float r2 = glm::dot(d, d);
+
+                if(node.leaf){
+                    for(int i = node.begin; i < node.end; i++)
+                        walk.addInteraction(sourcePos[i], sourceGM[i]);
+                    continue;
+                }
+
+                float size = 2.0f * node.halfSize;
+                if(size * size < theta2 * r2 && !contains(node, position)){
+                    walk.addInteraction(node.centerOfMass, node.GM);
+                    continue;
+                }
+
+                for(int c = 0; c < 8; c++)
+                    if(node.children[c] >= 0)
+                        walk.stack.push_back(node.children[c]);
+            }
+
+            float acc[3] = {0.0f, 0.0f, 0.0f};
+            gravityKernels().oneTarget(position.x, position.y, position.z,
+                                       walk.listX.data(), walk.listY.data(), walk.listZ.data(), walk.listGM.data(),
+                                       (int)walk.listX.size(), eps2, acc);
+            return glm::vec3(acc[0], acc[1], acc[2]);
+        }
+
+        //a cell whose center of mass is far away can still contain the point itself, those always get opened
+        static bool contains(const Node& node, const glm::vec3& p){
+            glm::vec3 d = p - node.center;
+            return std::fabs(d.x) <= node.halfSize && std::fabs(d.y) <= node.halfSize && std::fabs(d.z) <= node.halfSize;
+        }
+};
+
+#endif
@@ -24,7 +24,8 @@ class Camera
 {
 public:
     //camera Attributes
-    glm::vec3 Position;
+    //world position in double, the scene is drawn relative to it so float only ever sees small offsets
+    glm::dvec3 Position;
     glm::vec3 Front;
     glm::vec3 Up;
     glm::vec3 Right;
@@ -38,7 +39,7 @@ public:
     float Zoom;
 
     //constructor with vectors
-    Camera(glm::vec3 position = glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM){
+    Camera(glm::dvec3 position = glm::dvec3(0.0, 0.0, 0.0), glm::vec3 up = glm::vec3(0.0f, 1.0f, 0.0f), float yaw = YAW, float pitch = PITCH) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM){
         Position = position;
         WorldUp = up;
         Yaw = yaw;
@@ -47,7 +48,7 @@ public:
     }
     //Constructor with scalar values
     Camera(float posX, float posY, float posZ, float upX, float upY, float upZ, float yaw, float pitch) : Front(glm::vec3(0.0f, 0.0f, -1.0f)), MovementSpeed(SPEED), MouseSensitivity(SENSITIVITY), Zoom(ZOOM){
-        Position = glm::vec3(posX, posY, posZ);
+        Position = glm::dvec3(posX, posY, posZ);
         WorldUp = glm::vec3(upX, upY, upZ);
         Yaw = yaw;
         Pitch = pitch;
@@ -55,21 +56,27 @@ public:
     }
 
     //return the view matrix calculated using Euler Angles and the LookAt Matrix
+    //camera-relative: only the rotation, the camera sits at the origin and models are translated by RelativePosition
     glm::mat4 GetViewMatrix(){
-        return glm::lookAt(Position, Position + Front, Up);
+        return glm::lookAt(glm::vec3(0.0f), Front, Up);
+    }
+
+    //world position as seen from the camera, subtracted in double and only then rounded to float
+    glm::vec3 RelativePosition(const glm::dvec3& worldPosition) const {
+        return glm::vec3(worldPosition - Position);
     }
 
     //Processes input received from any keyboard-like input system. Accepts input parameter in the form of camera defined ENUM (to abstract it from windowing systems)
     void ProcessKeyboard(Camera_Movement direction, float deltaTime){
-        float velocity = MovementSpeed * deltaTime;
+        double velocity = MovementSpeed * deltaTime;
         if(direction == FORWARD)
-            Position += Front * velocity;
+            Position += glm::dvec3(Front) * velocity;
         if(direction == BACKWARD)
-            Position -= Front * velocity;
+            Position -= glm::dvec3(Front) * velocity;
         if(direction == LEFT)
-            Position -= Right * velocity;
+            Position -= glm::dvec3(Right) * velocity;
         if(direction == RIGHT)
-            Position += Right * velocity;
+            Position += glm::dvec3(Right) * velocity;
     }
 
     //Processes input received from a mouse input system. Expects the offset value in both the x and y direction.
@@ -16,181 +16,86 @@
 #include "ASSIMP.h"
 #include "SHADER.h"
 #include "CAMERA.h"
+#include "PHYSICS.h"
+#include "TEXTURE_ARRAY.h"
 /*
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb/stb_image.h"
 */
+
+//what one body contributes to an instanced draw, laid out exactly as the per-instance attributes
+//(model at locations 3-6, attenuation at 7, layer at 8); the light itself comes from the per-frame block
+struct BodyInstance{
+
+    glm::mat4 model;
+    //constant, linear, quadratic
+    glm::vec3 attenuation;
+    //layer of the batch's texture array, -1 draws the placeholder while the texture is still loading
+    float layer;
+};
+
 class CelestialBody{
 
     public:
 
         const char* path;
        
-        Shader shader;
+        //shared with every other body drawn by the same program
+        Shader& shader;
 
+        //the texture is a layer of a shared array, filled in the background after bodyTextures().load();
+        //which sphere mesh draws the body is up to the renderer, by its size on screen
         CelestialBody(Shader& shader, const char* path):path(path), shader(shader){ 
 
-            SphereMesh();
-            setupMesh();
-            addexture();
+            surface = bodyTextures().acquire(path);
         }
 
-        virtual void Draw(glm::mat4 view, 
-                glm::mat4 projection, 
-               float dt
-                ) {
-
-            shader.use();
-            shader.setMat4("view", view);
-            shader.setMat4("projection", projection);
-
-            shader.setInt("_texture", 0); 
+        //fills this body's slot of an instanced draw, 'origin' is the camera's world position every model is drawn relative to.
+        //Bodies of one kind are filled in parallel, so this may only write to the body itself
+        virtual void instance(BodyInstance& out, float dt, const glm::dvec3& origin) = 0;
 
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, textureID);
-
-            glBindVertexArray(VAO);
-            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
-            glBindVertexArray(0);
-            
+        const TextureLayer& texture() const {
+            return surface;
         }
 
         virtual glm::mat4 planetNoSpin_model() const {
             return glm::mat4(1.0f); // or throw or return dummy matrix
         }
 
-        protected:
-        
-        std::vector<float> vertices;
-        std::vector<unsigned int> indices;
+        //centre of the body this frame, in world space; culling reads it before any instance() runs
+        virtual glm::dvec3 worldPosition() const = 0;
 
-        unsigned int VBO = 0, VAO = 0, EBO = 0, textureID;;
-        int indexCount;
+        //bounding sphere radius around worldPosition(), the mesh is a unit sphere scaled by it
+        virtual float radius() const = 0;
 
-        void prepareDraw(glm::mat4 view, glm::mat4 projection) {
-            shader.use();
-            shader.setMat4("view", view);
-            shader.setMat4("projection", projection);
-            shader.setInt("_texture", 0); 
+        //the body this one orbits as part of its system, moons are culled together with it
+        virtual const CelestialBody* parent() const {
+            return nullptr;
+        }
 
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, textureID);
+        //link this render object to a row of the body table, instance() then only reads its position
+        void attachBody(BodyTable* table, int index){
+            bodies = table;
+            bodyIndex = index;
+            table->texture[index] = surface.id;
         }
 
+        protected:
 
-        void SphereMesh(){
-            
-            int X_SEGMENTS = 64;
-            int Y_SEGMENTS = 64;
-            const float PI = 3.14159;
-            
-            for(unsigned int y = 0; y <= Y_SEGMENTS; y++){
-                for(unsigned int x = 0; x <= X_SEGMENTS; x++){
-                    float yStack = ((float)y / (float)Y_SEGMENTS);
-                    float xSector = ((float)x / (float)X_SEGMENTS);
-                   
-                    float phi = PI * yStack;
-                    float theta = 2 * PI * xSector;
-
-                    float xPos = std::cos(theta) * std::sin(phi);
-                    float yPos = std::cos(phi);
-                    float zPos = std::sin(theta) * std::sin(phi);
-
-                    //calculate uv
-                    float xUV = (float)x/X_SEGMENTS;
-                    float yUV = (float)y/Y_SEGMENTS;
-
-                    //positions
-                    vertices.push_back(xPos);
-                    vertices.push_back(yPos);
-                    vertices.push_back(zPos);
-                   
-                    //normals
-                    vertices.push_back(xPos);
-                    vertices.push_back(yPos);
-                    vertices.push_back(zPos);
-
-                    //texCoord
-                    vertices.push_back(xUV);
-                    vertices.push_back(yUV);
-
-
-                }
-            }
-            
-            for(unsigned int y = 0; y < Y_SEGMENTS; y++){
-                for(unsigned int x = 0; x < X_SEGMENTS; x++){
-                    unsigned int first = (y * (X_SEGMENTS + 1)) + x;
-                    unsigned int second = first + X_SEGMENTS + 1;
-                    indices.push_back(first);
-                    indices.push_back(second);
-                    indices.push_back(first + 1);
-             
-                    indices.push_back(second);
-                    indices.push_back(second + 1);
-                    indices.push_back(first + 1);
-                }
-            }
-
-            indexCount = indices.size();
+        TextureLayer surface;
 
-        }
-        
-        void setupMesh(){
-            glGenVertexArrays(1, &VAO);
-            glGenBuffers(1, &VBO);
-            glGenBuffers(1, &EBO);
-           
-            glBindVertexArray(VAO);
-           
-            glBindBuffer(GL_ARRAY_BUFFER, VBO);
-            glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
-           
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
-           
-            glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-            glEnableVertexAttribArray(0);
-        
-            glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-            glEnableVertexAttribArray(1);
-           
-            glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8*sizeof(float), (void*)(6*sizeof(float)));
-            glEnableVertexAttribArray(2);
-            
+        const BodyTable* bodies = nullptr;
+        int bodyIndex = -1;
 
-           glBindBuffer(GL_ARRAY_BUFFER, 0);
-           glBindVertexArray(0);
+        //interpolated simulation position if attached, otherwise the position the object was created with
+        glm::dvec3 simulatedPosition(const glm::vec3& initial) const {
+            return bodies ? bodies->renderPosition(bodyIndex) : glm::dvec3(initial);
         }
-        void addexture(){
-            glGenTextures(1, &textureID);
-
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
-            int width, height, nrChannel;
-            stbi_set_flip_vertically_on_load(true);
-            unsigned char* data = stbi_load(path, &width, &height, &nrChannel, 0);
-            
-            if(!data){
-                std::cout << "FAILED TO LOAD TEXTURE\n";
-                return;
-            }
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, textureID);
-           
-            GLenum format = GL_RGB;
-            if (nrChannel == 1) format = GL_RED;
-            else if (nrChannel == 3) format = GL_RGB;
-            else if (nrChannel == 4) format = GL_RGBA;
-            glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-
-            glGenerateMipmap(GL_TEXTURE_2D);
-            stbi_image_free(data);
-            
-       }
+        //the same relative to 'origin'. Subtracted in double so only the small camera-relative result is rounded to float
+        glm::vec3 relativePosition(const glm::vec3& initial, const glm::dvec3& origin) const {
+            return glm::vec3(simulatedPosition(initial) - origin);
+        }
 
 };
 
@@ -209,19 +114,25 @@ class Star: public CelestialBody{
                 scale(scale)
                 {}
         
-        void Draw(glm::mat4 view, glm::mat4 projection, float dt) override{
+        void instance(BodyInstance& out, float dt, const glm::dvec3& origin) override{
             
-            prepareDraw(view, projection);
             float rotationSpeed = 0.01f;
             glm::mat4 model = glm::mat4(1.0f);
-            model = glm::translate(model, pos);
+            model = glm::translate(model, relativePosition(pos, origin));
             model = glm::rotate(model, dt*rotationSpeed, glm::vec3(0.0f, 1.0f, 0.0f));
             model = glm::scale(model, glm::vec3(scale));
-            shader.setMat4("model", model);
-            
-            glBindVertexArray(VAO);
-            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
-            glBindVertexArray(0);
+
+            //the star is unlit
+            out.model = model;
+            out.attenuation = glm::vec3(1.0f, 0.0f, 0.0f);
+        }
+
+        glm::dvec3 worldPosition() const override{
+            return simulatedPosition(pos);
+        }
+
+        float radius() const override{
+            return scale;
         }
 };
 
@@ -234,92 +145,65 @@ class Planet: public CelestialBody{
 
         glm::vec3 pos;
 
-        float orbitSpeed;
         float spinSpeed;
         float axialTilt;
         float scale;
 
-        glm::vec3 lightPos;
-        glm::vec3 viewPos;
         float constant;
         float linear;
         float quadratic;
 
+        //camera-relative once the planet has been drawn
         glm::mat4 noSpin_model;
 
         Planet(Shader& shader,
                 glm::vec3 pos, 
                 const char* path, 
-                float orbitSpeed,
                 float spinSpeed,
                 float axialTilt,
                 float scale,
-                glm::vec3 lightPos,
-                glm::vec3 viewPos,
                 float constant,
                 float linear,
                 float quadratic
                 ):CelestialBody(shader, path),
                 pos(pos),
-                orbitSpeed(orbitSpeed),
                 spinSpeed(spinSpeed),
                 axialTilt(axialTilt),
                 scale(scale),
-                lightPos(lightPos),
-                viewPos(viewPos),
                 constant(constant),
                 linear(linear),
                 quadratic(quadratic)
                 {
-                    baseModel = glm::translate(glm::mat4(1.0f), pos);
-                    baseModel = glm::rotate(baseModel, axialTilt, glm::vec3(0.0f, 1.0f, 0.0f));
-                    noSpin_model = baseModel;
+                    noSpin_model = glm::translate(glm::mat4(1.0f), pos);
+                    noSpin_model = glm::rotate(noSpin_model, axialTilt, glm::vec3(0.0f, 1.0f, 0.0f));
                 }           
 
 
-        void Draw(glm::mat4 view, 
-                glm::mat4 projection, 
-               float dt
-                ) override{
-
-            shader.use();
-
-            prepareDraw(view, projection);
+        void instance(BodyInstance& out, float dt, const glm::dvec3& origin) override{
 
-            shader.setVec3("lightPos", lightPos);
-            shader.setVec3("viewPos", viewPos);
-          
-            shader.setFloat("constant", constant);
-            shader.setFloat("linear", linear);
-            shader.setFloat("quadratic", quadratic);
+            out.attenuation = glm::vec3(constant, linear, quadratic);
             
-            if (orbitSpeed != 0.0f) {
-                noSpin_model = glm::rotate(glm::mat4(1.0f), dt * orbitSpeed, glm::vec3(0.0f, 1.0f, 0.0f));
-                noSpin_model = glm::translate(noSpin_model, pos);  // Apply position AFTER rotation
-                noSpin_model = glm::rotate(noSpin_model, axialTilt, glm::vec3(0.0f, 1.0f, 0.0f));
-            } else {
-                noSpin_model = baseModel;
-            }
+            //orbit comes from the simulation, only the spin is still driven by time
+            noSpin_model = glm::translate(glm::mat4(1.0f), relativePosition(pos, origin));
+            noSpin_model = glm::rotate(noSpin_model, axialTilt, glm::vec3(0.0f, 1.0f, 0.0f));
 
             glm::mat4 Spin_model = noSpin_model;
             Spin_model = glm::rotate(Spin_model, dt * spinSpeed, glm::vec3(0.0f, 1.0f, 0.0f));
             Spin_model = glm::scale(Spin_model, glm::vec3(scale, scale, scale));
-            shader.setMat4("model", Spin_model);
-
-
-
-            glBindVertexArray(VAO);
-            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
-            glBindVertexArray(0);
-            
+            out.model = Spin_model;
         }
         
         glm::mat4 planetNoSpin_model() const  override{
             return noSpin_model;
         }
 
-    private:
-        glm::mat4 baseModel;
+        glm::dvec3 worldPosition() const override{
+            return simulatedPosition(pos);
+        }
+
+        float radius() const override{
+            return scale;
+        }
 };
 
 class Moon: public CelestialBody{
@@ -330,12 +214,9 @@ class Moon: public CelestialBody{
 
         glm::vec3 pos;
 
-        float orbitSpeed;
         float axialTilt;
         float scale;
 
-        glm::vec3 lightPos;
-        glm::vec3 viewPos;
         float constant;
         float linear;
         float quadratic;
@@ -344,11 +225,8 @@ class Moon: public CelestialBody{
         Moon(Shader& shader,
                 glm::vec3 pos, 
                 const char* path, 
-                float orbitSpeed,
                 float axialTilt,
                 float scale,
-                glm::vec3 lightPos,
-                glm::vec3 viewPos,
                 const CelestialBody* parent,
                 float constant,
                 float linear,
@@ -356,11 +234,8 @@ class Moon: public CelestialBody{
                 ):CelestialBody(shader, path),
                 parentBody(parent),
                 pos(pos),
-                orbitSpeed(orbitSpeed),
                 axialTilt(axialTilt),
                 scale(scale),
-                lightPos(lightPos),
-                viewPos(viewPos),
                 constant(constant),
                 linear(linear),
                 quadratic(quadratic)
@@ -368,40 +243,31 @@ class Moon: public CelestialBody{
         }
 
 
-        void Draw(glm::mat4 view, 
-                glm::mat4 projection, 
-               float dt
-                ) override{
+        void instance(BodyInstance& out, float, const glm::dvec3& origin) override{
 
-            shader.use();
-            shader.setMat4("view", view);
-            shader.setMat4("projection", projection);
-
-            shader.setVec3("lightPos", lightPos);
-            shader.setVec3("viewPos", viewPos);
-            
-            shader.setFloat("constant", constant);
-            shader.setFloat("linear", linear);
-            shader.setFloat("quadratic", quadratic);
+            out.attenuation = glm::vec3(constant, linear, quadratic);
 
             glm::mat4 model = glm::mat4(1.0f);
-            model = glm::rotate(model, dt * orbitSpeed, glm::vec3(0.0f, 1.0f, 0.0f));
-            model = glm::translate(model, pos);
+            model = glm::translate(model, glm::vec3(worldPosition() - origin));
             model = glm::rotate(model, axialTilt, glm::vec3(0.0f, 1.0f, 0.0f));
             model = glm::scale(model, glm::vec3(scale, scale, scale));
-            model = parentBody->planetNoSpin_model() * model;
 
-            shader.setMat4("model", model);
+            out.model = model;
+        }
 
-            shader.setInt("texture_diffuse", 0); 
+        //'pos' is relative to the parent and turned with its axial tilt, only used when the moon isn't simulated
+        glm::dvec3 worldPosition() const override{
+            if(bodies)
+                return bodies->renderPosition(bodyIndex);
+            return parentBody->worldPosition() + glm::dvec3(glm::mat3(parentBody->planetNoSpin_model()) * pos);
+        }
 
-            glActiveTexture(GL_TEXTURE0);
-            glBindTexture(GL_TEXTURE_2D, textureID);
+        float radius() const override{
+            return scale;
+        }
 
-            glBindVertexArray(VAO);
-            glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, 0);
-            glBindVertexArray(0);
-            
+        const CelestialBody* parent() const override{
+            return parentBody;
         }
 
 };
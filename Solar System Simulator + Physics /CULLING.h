@@ -0,0 +1,332 @@
+#ifndef CULLING_H
+#define CULLING_H
+
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "CELESTIAL_OBJECTS.h"
+#include "THREAD_POOL.h"
+
+//The view frustum as planes pointing inwards, in camera-relative render space.
+//Only the four sides and the near plane: the far plane sits billions of units out and extracting it
+//from a float matrix with that near/far ratio gives nothing usable, nothing in the scene is that far anyway.
+struct Frustum{
+
+    static const int PLANES = 5;
+    //xyz: normal, w: distance, dot(normal, p) + w >= 0 inside
+    glm::dvec4 planes[PLANES];
+
+    enum Side{ OUTSIDE, INTERSECTING, INSIDE };
+
+    //Gribb/Hartmann: every plane is a sum or difference of the matrix rows
+    static Frustum fromMatrix(const glm::mat4& viewProjection){
+
+        glm::dmat4 m(viewProjection);
+        glm::dvec4 rows[4];
+        for(int r = 0; r < 4; r++)
+            rows[r] = glm::dvec4(m[0][r], m[1][r], m[2][r], m[3][r]);
+
+        Frustum frustum;
+        frustum.planes[0] = rows[3] + rows[0];
+        frustum.planes[1] = rows[3] - rows[0];
+        frustum.planes[2] = rows[3] + rows[1];
+        frustum.planes[3] = rows[3] - rows[1];
+        //with the reversed-Z projection (DEPTH.h) this lands at +near instead of -near, just as good for culling
+        frustum.planes[4] = rows[3] + rows[2];
+
+        for(auto &plane: frustum.planes)
+            plane = plane / glm::length(glm::dvec3(plane));
+        return frustum;
+    }
+
+    Side classify(const glm::dvec3& center, double radius) const {
+
+        Side side = INSIDE;
+        for(const auto &plane: planes){
+            double distance = glm::dot(glm::dvec3(plane), center) + plane.w;
+            if(distance < -radius)
+                return OUTSIDE;
+            if(distance < radius)
+                side = INTERSECTING;
+        }
+        return side;
+    }
+};
+
+//Decides every frame which bodies are in view.
+//Bodies are grouped into systems, a root (star or planet) and the moons that name it as parent(), each bounded by
+//a sphere around all of them. The systems sit in a bounding-sphere BVH: every frame the tree is refitted bottom-up to
+//where the bodies are now, and only rebuilt when refitting has let some node grow well past its size at the last build
+//(or systems were added). The walk drops whole subtrees outside the frustum and accepts whole subtrees inside it;
+//only systems straddling a plane test their bodies one by one.
+class FrustumCuller{
+
+    public:
+
+        //bodies drawn / culled by the last update()
+        int drawn = 0;
+        int culled = 0;
+
+        //returns the id visible() answers to; parents have to be added before their moons
+        int add(const CelestialBody* body){
+
+            int id = (int)bodies.size();
+            bodies.push_back(body);
+            positions.push_back(glm::dvec3(0.0));
+            visibility.push_back(0);
+            ids[body] = id;
+
+            auto parent = body->parent() ? ids.find(body->parent()) : ids.end();
+            if(parent != ids.end()){
+                systems[systemOf[parent->second]].members.push_back(id);
+                systemOf.push_back(systemOf[parent->second]);
+            }
+            else{
+                System system;
+                system.members.push_back(id);
+                systemOf.push_back((int)systems.size());
+                systems.push_back(system);
+            }
+            dirty = true;
+            return id;
+        }
+
+        //'viewProjection' maps camera-relative space, 'origin' is where the camera is in the world
+        void update(const glm::mat4& viewProjection, const glm::dvec3& origin){
+
+            Frustum frustum = Frustum::fromMatrix(viewProjection);
+
+            //positions are interpolated from the simulation, read each once
+            workerPool().parallelFor(0, (int)bodies.size(), POSITION_CHUNK, [&](int begin, int end){
+                for(int i = begin; i < end; i++){
+                    positions[i] = bodies[i]->worldPosition();
+                    visibility[i] = 0;
+                }
+            });
+
+            for(auto &system: systems)
+                boundSystem(system);
+
+            if(dirty || !refit())
+                rebuild();
+
+            drawn = 0;
+            if(!nodes.empty())
+                walk(frustum, origin);
+            culled = (int)bodies.size() - drawn;
+        }
+
+        bool visible(int id) const {
+            return visibility[id] != 0;
+        }
+
+        //world position of a body as of the last update()
+        const glm::dvec3& position(int id) const {
+            return positions[id];
+        }
+
+    private:
+
+        struct System{
+
+            std::vector<int> members;
+            glm::dvec3 center = glm::dvec3(0.0);
+            double radius = 0.0;
+        };
+
+        struct Node{
+
+            glm::dvec3 center = glm::dvec3(0.0);
+            double radius = 0.0;
+            //radius right after the last build, refitting may grow it
+            double builtRadius = 0.0;
+            //children for an inner node; a leaf owns order[first, first + count)
+            int left = -1, right = -1;
+            int first = 0, count = 0;
+        };
+
+        static const int POSITION_CHUNK = 1024;
+        static const int LEAF_SYSTEMS = 4;
+        //refitted nodes this much bigger than when built trigger a rebuild
+        static constexpr double REBUILD_GROWTH = 2.0;
+
+        std::vector<const CelestialBody*> bodies;
+        std::vector<glm::dvec3> positions;
+        std::vector<char> visibility;
+        std::vector<int> systemOf;
+        std::unordered_map<const CelestialBody*, int> ids;
+
+        std::vector<System> systems;
+        std::vector<Node> nodes;
+        //system indices, leaves point into it
+        std::vector<int> order;
+        bool dirty = true;
+
+        //centred on the root, reaching the far side of the outermost moon
+        void boundSystem(System& system){
+            system.center = positions[system.members[0]];
+            system.radius = 0.0;
+            for(int id: system.members)
+                system.radius = std::max(system.radius, glm::length(positions[id] - system.center) + bodies[id]->radius());
+        }
+
+        //smallest sphere around two spheres
+        static void merge(glm::dvec3& center, double& radius, const glm::dvec3& otherCenter, double otherRadius){
+
+            glm::dvec3 offset = otherCenter - center;
+            double distance = glm::length(offset);
+            if(distance + otherRadius <= radius)
+                return;
+            if(distance + radius <= otherRadius){
+                center = otherCenter;
+                radius = otherRadius;
+                return;
+            }
+            double merged = (distance + radius + otherRadius) * 0.5;
+            center += offset * ((merged - radius) / distance);
+            radius = merged;
+        }
+
+        void boundLeaf(Node& node){
+            const System& first = systems[order[node.first]];
+            node.center = first.center;
+            node.radius = first.radius;
+            for(int i = node.first + 1; i < node.first + node.count; i++)
+                merge(node.center, node.radius, systems[order[i]].center, systems[order[i]].radius);
+        }
+
+        //children come after their parent in 'nodes', so a reverse pass sees them first.
+        //False once some node has outgrown its build
+        bool refit(){
+
+            bool fits = true;
+            for(int n = (int)nodes.size() - 1; n >= 0; n--){
+                Node& node = nodes[n];
+                if(node.count > 0){
+                    boundLeaf(node);
+                }
+                else{
+                    node.center = nodes[node.left].center;
+                    node.radius = nodes[node.left].radius;
+                    merge(node.center, node.radius, nodes[node.right].center, nodes[node.right].radius);
+                }
+                if(node.radius > node.builtRadius * REBUILD_GROWTH + 1.0)
+                    fits = false;
+            }
+            return fits;
+        }
+
+        void rebuild(){
+
+            nodes.clear();
+            order.resize(systems.size());
+            for(int i = 0; i < (int)order.size(); i++)
+                order[i] = i;
+            if(!order.empty())
+                build(0, (int)order.size());
+            dirty = false;
+        }
+
+        //top-down, split at the median along the axis the system centres spread furthest on
+        int build(int first, int count){
+
+            int index = (int)nodes.size();
+            nodes.push_back(Node());
+
+            if(count <= LEAF_SYSTEMS){
+                nodes[index].first = first;
+                nodes[index].count = count;
+                boundLeaf(nodes[index]);
+                nodes[index].builtRadius = nodes[index].radius;
+                return index;
+            }
+
+            glm::dvec3 low = systems[order[first]].center, high = low;
+            for(int i = first + 1; i < first + count; i++){
+                low = glm::min(low, systems[order[i]].center);
+                high = glm::max(high, systems[order[i]].center);
+            }
+            glm::dvec3 extent = high - low;
+            int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+            int half = count / 2;
+            std::nth_element(order.begin() + first, order.begin() + first + half, order.begin() + first + count, [&](int a, int b){
+                return systems[a].center[axis] < systems[b].center[axis];
+            });
+
+            int left = build(first, half);
+            int right = build(first + half, count - half);
+
+            Node& node = nodes[index];
+            node.left = left;
+            node.right = right;
+            node.center = nodes[left].center;
+            node.radius = nodes[left].radius;
+            merge(node.center, node.radius, nodes[right].center, nodes[right].radius);
+            node.builtRadius = node.radius;
+            return index;
+        }
+
+        void show(int id){
+            visibility[id] = 1;
+            drawn++;
+        }
+
+        void showSystem(const System& system){
+            for(int id: system.members)
+                show(id);
+        }
+
+        void showSubtree(const Node& node){
+            if(node.count > 0){
+                for(int i = node.first; i < node.first + node.count; i++)
+                    showSystem(systems[order[i]]);
+                return;
+            }
+            showSubtree(nodes[node.left]);
+            showSubtree(nodes[node.right]);
+        }
+
+        void walk(const Frustum& frustum, const glm::dvec3& origin){
+
+            std::vector<int> stack(1, 0);
+            while(!stack.empty()){
+
+                const Node& node = nodes[stack.back()];
+                stack.pop_back();
+
+                Frustum::Side side = frustum.classify(node.center - origin, node.radius);
+                if(side == Frustum::OUTSIDE)
+                    continue;
+                if(side == Frustum::INSIDE){
+                    showSubtree(node);
+                    continue;
+                }
+
+                if(node.count == 0){
+                    stack.push_back(node.left);
+                    stack.push_back(node.right);
+                    continue;
+                }
+
+                for(int i = node.first; i < node.first + node.count; i++){
+                    const System& system = systems[order[i]];
+                    side = frustum.classify(system.center - origin, system.radius);
+                    if(side == Frustum::INSIDE){
+                        showSystem(system);
+                    }
+                    else if(side == Frustum::INTERSECTING){
+                        for(int id: system.members)
+                            if(frustum.classify(positions[id] - origin, bodies[id]->radius()) != Frustum::OUTSIDE)
+                                show(id);
+                    }
+                }
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,174 @@
+#ifndef DEPTH_H
+#define DEPTH_H
+
+#include <iostream>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+#include <string>
+
+#include "glad/glad.h"
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "SHADER.h"
+
+//the scene runs from the cockpit to the far side of the outer orbits
+const float DEPTH_NEAR = 0.1f;
+const float DEPTH_FAR = 3000000000.0f;
+
+//GL 4.5 / ARB_clip_control, not in the 3.3 loader
+#ifndef GL_ZERO_TO_ONE
+#define GL_ZERO_TO_ONE 0x935F
+#endif
+typedef void (APIENTRYP CLIPCONTROLPROC)(GLenum origin, GLenum depth);
+
+//STANDARD: the usual [-1, 1] perspective into the default 24-bit buffer. With a near/far ratio of 3e10
+//  nearly all of it is spent in front of the cockpit and distant orbits z-fight.
+//REVERSED_Z: a 32-bit float depth target cleared to 0, an infinite projection mapping the near plane to 1,
+//  GL_GREATER and glClipControl so z/w isn't squashed through [-1, 1]. Float precision falls off
+//  with distance the way 1/z does and the two cancel out, near constant relative precision everywhere.
+//LOGARITHMIC: every fragment writes log(1 + w) as its depth. Works on any GL 3.3 driver but turns off
+//  early depth testing, so it is what REVERSED_Z falls back to without glClipControl.
+enum class DepthMode{ STANDARD, REVERSED_Z, LOGARITHMIC };
+
+class DepthBuffer{
+
+    public:
+
+        DepthMode mode = DepthMode::STANDARD;
+
+        //needs a current GL context and has to come before any Shader is compiled, the modes differ in the shaders too.
+        //'width' and 'height' are the framebuffer's
+        void setup(DepthMode requested, int width, int height){
+
+            mode = requested;
+            if(mode == DepthMode::REVERSED_Z){
+                CLIPCONTROLPROC clipControl = loadClipControl();
+                if(clipControl){
+                    clipControl(GL_LOWER_LEFT, GL_ZERO_TO_ONE);
+                    createTarget(width, height);
+                }
+                else{
+                    std::cout << "REVERSED-Z: NO glClipControl, USING LOGARITHMIC DEPTH\n";
+                    mode = DepthMode::LOGARITHMIC;
+                }
+            }
+
+            glClearDepth(mode == DepthMode::REVERSED_Z ? 0.0 : 1.0);
+            glDepthFunc(mode == DepthMode::REVERSED_Z ? GL_GREATER : GL_LESS);
+
+            //logDepth() is declared for both stages, it maps a clip w to [0, 1]
+            char defines[256];
+            if(mode == DepthMode::LOGARITHMIC)
+                std::snprintf(defines, sizeof(defines),
+                    "#define LOG_DEPTH\n#define DEPTH_FAR %.1f\nfloat logDepth(float w){ return log2(1.0 + w) / log2(DEPTH_FAR + 1.0); }\n", DEPTH_FAR);
+            else if(mode == DepthMode::REVERSED_Z)
+                std::snprintf(defines, sizeof(defines), "#define REVERSED_Z\n");
+            else
+                defines[0] = '\0';
+            shaderDefines() += defines;
+        }
+
+        const char* name() const {
+            return mode == DepthMode::REVERSED_Z ? "REVERSED-Z FLOAT" : mode == DepthMode::LOGARITHMIC ? "LOGARITHMIC" : "STANDARD";
+        }
+
+        glm::mat4 projection(float fovy, float aspect) const {
+
+            if(mode != DepthMode::REVERSED_Z)
+                return glm::perspective(fovy, aspect, DEPTH_NEAR, DEPTH_FAR);
+
+            //z_clip = near, w_clip = -z_view: depth is near / distance, 1 at the near plane and 0 at infinity
+            float f = 1.0f / std::tan(fovy * 0.5f);
+            glm::mat4 projection(0.0f);
+            projection[0][0] = f / aspect;
+            projection[1][1] = f;
+            projection[2][3] = -1.0f;
+            projection[3][2] = DEPTH_NEAR;
+            return projection;
+        }
+
+        //from the framebuffer size callback
+        void resize(int width, int height){
+            if(FBO && width > 0 && height > 0)
+                allocate(width, height);
+        }
+
+        //binds what the frame is drawn into and clears it
+        void beginFrame(){
+            glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
+
+        //copies the frame to the window, before swapping
+        void endFrame(){
+
+            if(!FBO)
+                return;
+
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, FBO);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+            glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+    private:
+
+        //only for REVERSED_Z: GLFW can't ask for a float depth buffer on the window, so the frame is drawn off-screen
+        unsigned int FBO = 0, colorRBO = 0, depthRBO = 0;
+        int width = 0, height = 0;
+
+        static CLIPCONTROLPROC loadClipControl(){
+
+            int major = 0, minor = 0;
+            glGetIntegerv(GL_MAJOR_VERSION, &major);
+            glGetIntegerv(GL_MINOR_VERSION, &minor);
+            bool supported = major > 4 || (major == 4 && minor >= 5);
+
+            int count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for(int i = 0; i < count && !supported; i++){
+                const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+                supported = name && std::strcmp(name, "GL_ARB_clip_control") == 0;
+            }
+
+            //some drivers hand out entry points they don't support, so only after the check
+            return supported ? (CLIPCONTROLPROC)glfwGetProcAddress("glClipControl") : nullptr;
+        }
+
+        void createTarget(int width, int height){
+
+            glGenFramebuffers(1, &FBO);
+            glGenRenderbuffers(1, &colorRBO);
+            glGenRenderbuffers(1, &depthRBO);
+            allocate(width, height);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRBO);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRBO);
+            if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "REVERSED-Z: FLOAT DEPTH FRAMEBUFFER INCOMPLETE\n";
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        }
+
+        void allocate(int width, int height){
+
+            this->width = width;
+            this->height = height;
+
+            glBindRenderbuffer(GL_RENDERBUFFER, colorRBO);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+            glBindRenderbuffer(GL_RENDERBUFFER, depthRBO);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F, width, height);
+            glBindRenderbuffer(GL_RENDERBUFFER, 0);
+        }
+};
+
+inline DepthBuffer& depthBuffer(){
+    static DepthBuffer buffer;
+    return buffer;
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef FRAME_UNIFORMS_H
+#define FRAME_UNIFORMS_H
+
+#include <cstring>
+
+#include "glad/glad.h"
+#include <glm/glm.hpp>
+
+#include "SHADER.h"
+
+//Per-frame data every shader reads from the std140 block
+//
+//  layout (std140) uniform FrameData { mat4 view; mat4 projection; vec4 lightPos; vec4 viewPos; };
+//
+//written once per frame instead of being uploaded to each program.
+//Everything in it is camera-relative, like the rest of render space.
+struct FrameData{
+
+    glm::mat4 view;
+    glm::mat4 projection;
+    //xyz: the star
+    glm::vec4 lightPos;
+    //xyz: the eye, the origin of render space
+    glm::vec4 viewPos;
+};
+
+//The block lives in a ring of FRAME_SLOTS slots inside one uniform buffer.
+//Each frame writes the next slot through an unsynchronized map, so the driver never stalls
+//on a buffer the GPU may still be reading; a fence per slot makes sure the GPU is done with it
+//before it comes around again. (Persistent mapping needs GL 4.4, this is the GL 3.3 equivalent.)
+class FrameUniforms{
+
+    public:
+
+        //needs a current GL context
+        FrameUniforms(){
+
+            int alignment = 256;
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+            slotSize = (sizeof(FrameData) + alignment - 1) / alignment * alignment;
+
+            glGenBuffers(1, &UBO);
+            glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+            glBufferData(GL_UNIFORM_BUFFER, slotSize * FRAME_SLOTS, nullptr, GL_DYNAMIC_DRAW);
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+            for(int i = 0; i < FRAME_SLOTS; i++)
+                fences[i] = 0;
+        }
+
+        //call once per frame before drawing anything that reads the block
+        void update(const FrameData& data){
+
+            slot = (slot + 1) % FRAME_SLOTS;
+
+            if(fences[slot]){
+                //normally long signalled, three frames have gone by since it was placed
+                glClientWaitSync(fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, FENCE_TIMEOUT);
+                glDeleteSync(fences[slot]);
+                fences[slot] = 0;
+            }
+
+            GLintptr offset = (GLintptr)(slot * slotSize);
+
+            glBindBuffer(GL_UNIFORM_BUFFER, UBO);
+            void* mapped = glMapBufferRange(GL_UNIFORM_BUFFER, offset, sizeof(FrameData),
+                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+            if(mapped){
+                std::memcpy(mapped, &data, sizeof(FrameData));
+                glUnmapBuffer(GL_UNIFORM_BUFFER);
+            }
+            else{
+                glBufferSubData(GL_UNIFORM_BUFFER, offset, sizeof(FrameData), &data);
+            }
+            glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+            glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_UNIFORMS_BINDING, UBO, offset, sizeof(FrameData));
+        }
+
+        //call after the last draw of the frame
+        void endFrame(){
+            fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+
+    private:
+
+        static const int FRAME_SLOTS = 3;
+        //nanoseconds
+        static const GLuint64 FENCE_TIMEOUT = 1000000000;
+
+        unsigned int UBO = 0;
+        size_t slotSize = 0;
+        int slot = 0;
+        GLsync fences[FRAME_SLOTS];
+};
+
+#endif
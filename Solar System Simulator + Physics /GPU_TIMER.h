@@ -0,0 +1,62 @@
+#ifndef GPU_TIMER_H
+#define GPU_TIMER_H
+
+#include <cstdint>
+
+#include "glad/glad.h"
+
+//GPU time spent between begin() and end(), through GL_TIME_ELAPSED queries.
+//Results come back a few frames late: each frame uses the next query of a small ring and only reads
+//the one it is about to reuse, which the GPU has long finished, so asking never stalls the pipeline.
+//Averaged over 'frames' frames; ready() says when a new average is in.
+class GpuTimer{
+
+    public:
+
+        //needs a current GL context
+        GpuTimer(int frames = 120) : frames(frames){
+            glGenQueries(QUERIES, queries);
+        }
+
+        void begin(){
+
+            unsigned int query = queries[next];
+            if(issued[next]){
+                GLuint64 nanoseconds = 0;
+                glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+                total += nanoseconds;
+                counted++;
+            }
+            glBeginQuery(GL_TIME_ELAPSED, query);
+            issued[next] = true;
+        }
+
+        void end(){
+            glEndQuery(GL_TIME_ELAPSED);
+            next = (next + 1) % QUERIES;
+        }
+
+        //true once per 'frames' frames, with the average in 'milliseconds'
+        bool ready(double& milliseconds){
+
+            if(counted < frames)
+                return false;
+            milliseconds = (double)total / counted * 1e-6;
+            total = 0;
+            counted = 0;
+            return true;
+        }
+
+    private:
+
+        static const int QUERIES = 4;
+        unsigned int queries[QUERIES];
+        bool issued[QUERIES] = {};
+        int next = 0;
+
+        int frames;
+        uint64_t total = 0;
+        int counted = 0;
+};
+
+#endif
@@ -0,0 +1,324 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include <vector>
+#include <cmath>
+#include <cstddef>
+#include <utility>
+#include <algorithm>
+
+#include "glad/glad.h"
+#include <glm/glm.hpp>
+
+#include "SHADER.h"
+#include "SPHERE_MESH.h"
+#include "CELESTIAL_OBJECTS.h"
+#include "THREAD_POOL.h"
+#include "CULLING.h"
+
+//Draws every registered body with instancing instead of one Draw call each.
+//Bodies sharing a shader and texture array form a batch. Each frame the bodies of a batch in view are sorted into
+//levels by how big they are on screen (selectSphereLod): one per sphere mesh of the LOD chain, and points for
+//the ones smaller than a pixel. Every level's BodyInstance records are filled (in parallel for big levels), streamed
+//into its own instance buffer and drawn with a single glDrawElementsInstanced, points with one glDrawArraysInstanced.
+//View, projection and lighting come from the per-frame FrameData block, so switching shaders only sets the sampler.
+//Bodies outside the view frustum are left out before anything is filled.
+//With 'impostors' on, every body bigger than a point is a camera-facing quad instead, 4 vertices ray-traced
+//against the sphere in its batch's impostor program (see SHADERS/impostor.glsl); the mesh chain is skipped.
+class InstancedRenderer{
+
+    public:
+
+        //draw calls issued by the last draw()
+        int drawCalls = 0;
+        //sphere triangles and point sprites drawn by the last draw()
+        long triangles = 0;
+        int points = 0;
+
+        //which bodies the last draw() left out, with the drawn/culled counts
+        FrustumCuller culler;
+
+        //draw spheres as ray-traced quads, for the batches that have an impostor program
+        bool impostors = false;
+
+        //needs a current GL context
+        InstancedRenderer() : pointShader("SHADERS/vertexShader_Point.glsl", "SHADERS/fragmentShader_Point.glsl"){
+            pointSampler = pointShader.uniform<int>("_texture");
+        }
+
+        //program drawing the bodies of 'meshShader' as impostors, has to be set before they are added
+        void setImpostorShader(Shader& meshShader, Shader& impostorShader){
+            impostorShaders.push_back(std::make_pair(&meshShader, &impostorShader));
+        }
+
+        //a parent has to be added before its moons, the culler groups them into one system
+        void add(CelestialBody* body){
+
+            int id = culler.add(body);
+            lod.push_back(NO_LEVEL);
+
+            for(auto &batch: batches){
+                if(batch.shader == &body->shader && batch.texture == body->texture().array){
+                    batch.bodies.push_back(body);
+                    batch.ids.push_back(id);
+                    return;
+                }
+            }
+
+            batches.push_back(createBatch(body));
+            batches.back().bodies.push_back(body);
+            batches.back().ids.push_back(id);
+        }
+
+        //'view' and 'projection' are the camera-relative matrices the frame is drawn with
+        void draw(float dt, const glm::dvec3& origin, const glm::mat4& view, const glm::mat4& projection, float viewportHeight){
+
+            drawCalls = 0;
+            triangles = 0;
+            points = 0;
+
+            culler.update(projection * view, origin);
+
+            //radius on screen in pixels for a radius of 1 at distance 1
+            float pixelScale = projection[1][1] * viewportHeight * 0.5f;
+
+            for(auto &batch: batches){
+
+                for(auto &level: batch.levels)
+                    level.bodies.clear();
+
+                for(size_t i = 0; i < batch.bodies.size(); i++){
+                    int id = batch.ids[i];
+                    if(!culler.visible(id))
+                        continue;
+
+                    //tangent of the angle the sphere covers, so it is right up close too
+                    double distance = glm::length(culler.position(id) - origin);
+                    double radius = batch.bodies[i]->radius();
+                    float pixels = distance > radius ? (float)(radius / std::sqrt(distance * distance - radius * radius)) * pixelScale : 1e9f;
+
+                    lod[id] = selectSphereLod(pixels, lod[id]);
+                    bool impostor = impostors && batch.impostorShader && lod[id] >= 0;
+                    batch.levels[impostor ? IMPOSTOR_LEVEL : lod[id] + 1].bodies.push_back(batch.bodies[i]);
+                }
+
+                for(auto &level: batch.levels)
+                    fill(level, dt, origin);
+            }
+
+            //triangle levels and impostors batch by batch, then every batch's points with the point program
+            Shader* current = nullptr;
+            for(auto &batch: batches){
+                for(int l = 1; l <= SPHERE_LODS; l++){
+
+                    Level& level = batch.levels[l];
+                    if(level.instances.empty())
+                        continue;
+
+                    if(batch.shader != current){
+                        current = batch.shader;
+                        current->use();
+                        current->set(batch.sampler, 0);
+                    }
+
+                    glActiveTexture(GL_TEXTURE0);
+                    glBindTexture(GL_TEXTURE_2D_ARRAY, batch.texture);
+
+                    glBindVertexArray(level.VAO);
+                    glDrawElementsInstanced(GL_TRIANGLES, level.mesh->indexCount, level.mesh->indexType, 0, (int)level.instances.size());
+                    drawCalls++;
+                    triangles += (long)level.mesh->indexCount / 3 * (long)level.instances.size();
+                }
+
+                Level& level = batch.levels[IMPOSTOR_LEVEL];
+                if(level.instances.empty())
+                    continue;
+
+                if(batch.impostorShader != current){
+                    current = batch.impostorShader;
+                    current->use();
+                    current->set(batch.impostorSampler, 0);
+                }
+
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, batch.texture);
+
+                glBindVertexArray(level.VAO);
+                glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (int)level.instances.size());
+                drawCalls++;
+                triangles += 2 * (long)level.instances.size();
+            }
+
+            for(auto &batch: batches){
+
+                Level& level = batch.levels[0];
+                if(level.instances.empty())
+                    continue;
+
+                if(current != &pointShader){
+                    current = &pointShader;
+                    current->use();
+                    current->set(pointSampler, 0);
+                }
+
+                glActiveTexture(GL_TEXTURE0);
+                glBindTexture(GL_TEXTURE_2D_ARRAY, batch.texture);
+
+                glBindVertexArray(level.VAO);
+                glDrawArraysInstanced(GL_POINTS, 0, 1, (int)level.instances.size());
+                drawCalls++;
+                points += (int)level.instances.size();
+            }
+            glBindVertexArray(0);
+        }
+
+    private:
+
+        //one sphere mesh of the chain (or the points, or the impostors) within a batch
+        struct Level{
+
+            //nullptr for the points and impostors
+            const SphereMesh* mesh = nullptr;
+
+            //the mesh buffers plus this level's instance buffer
+            unsigned int VAO = 0, instanceVBO = 0;
+            //instances the buffer currently has room for
+            size_t capacity = 0;
+
+            //this frame's bodies at this level
+            std::vector<CelestialBody*> bodies;
+            std::vector<BodyInstance> instances;
+        };
+
+        struct Batch{
+
+            Shader* shader;
+            //GL_TEXTURE_2D_ARRAY, each instance picks its layer
+            unsigned int texture;
+
+            std::vector<CelestialBody*> bodies;
+            //the culler's id for each body
+            std::vector<int> ids;
+
+            //points first, then the chain coarsest first, then the impostors
+            Level levels[SPHERE_LODS + 2];
+
+            Uniform<int> sampler;
+
+            //nullptr if the bodies can't be drawn as impostors
+            Shader* impostorShader = nullptr;
+            Uniform<int> impostorSampler;
+        };
+
+        static const int IMPOSTOR_LEVEL = SPHERE_LODS + 1;
+        std::vector<std::pair<Shader*, Shader*>> impostorShaders;
+
+        std::vector<Batch> batches;
+
+        //level each body (by culler id) was drawn at last frame, for the hysteresis
+        std::vector<int> lod;
+        static const int NO_LEVEL = -2;
+
+        //average texture colour per body, for everything smaller than a pixel
+        Shader pointShader;
+        Uniform<int> pointSampler;
+
+        //filling an instance is a few matrix products, chunks have to be big to be worth a task
+        static const int FILL_CHUNK = 2048;
+
+        Batch createBatch(CelestialBody* body){
+
+            Batch batch;
+            batch.shader = &body->shader;
+            batch.texture = body->texture().array;
+
+            batch.sampler = batch.shader->uniform<int>("_texture");
+
+            for(auto &pair: impostorShaders){
+                if(pair.first == batch.shader){
+                    batch.impostorShader = pair.second;
+                    batch.impostorSampler = pair.second->uniform<int>("_texture");
+                }
+            }
+
+            for(int l = 0; l <= IMPOSTOR_LEVEL; l++){
+
+                Level& level = batch.levels[l];
+                level.mesh = l == 0 || l == IMPOSTOR_LEVEL ? nullptr : &sphereMesh(SPHERE_LOD_SEGMENTS[l - 1]);
+
+                glGenVertexArrays(1, &level.VAO);
+                glGenBuffers(1, &level.instanceVBO);
+
+                glBindVertexArray(level.VAO);
+
+                if(level.mesh){
+                    glBindBuffer(GL_ARRAY_BUFFER, level.mesh->VBO);
+                    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, level.mesh->EBO);
+                    setSphereAttributes();
+                }
+
+                glBindBuffer(GL_ARRAY_BUFFER, level.instanceVBO);
+                setInstanceAttributes();
+
+                glBindBuffer(GL_ARRAY_BUFFER, 0);
+                glBindVertexArray(0);
+            }
+
+            return batch;
+        }
+
+        //BodyInstance from the bound GL_ARRAY_BUFFER, one per instance
+        static void setInstanceAttributes(){
+
+            //a mat4 attribute takes four consecutive locations, one column each
+            for(int c = 0; c < 4; c++){
+                glVertexAttribPointer(3 + c, 4, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)(offsetof(BodyInstance, model) + c * sizeof(glm::vec4)));
+                glEnableVertexAttribArray(3 + c);
+                glVertexAttribDivisor(3 + c, 1);
+            }
+
+            glVertexAttribPointer(7, 3, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)offsetof(BodyInstance, attenuation));
+            glEnableVertexAttribArray(7);
+            glVertexAttribDivisor(7, 1);
+
+            glVertexAttribPointer(8, 1, GL_FLOAT, GL_FALSE, sizeof(BodyInstance), (void*)offsetof(BodyInstance, layer));
+            glEnableVertexAttribArray(8);
+            glVertexAttribDivisor(8, 1);
+        }
+
+        void fill(Level& level, float dt, const glm::dvec3& origin){
+
+            int count = (int)level.bodies.size();
+            level.instances.resize(count);
+            if(count == 0)
+                return;
+
+            workerPool().parallelFor(0, count, FILL_CHUNK, [&](int begin, int end){
+                for(int i = begin; i < end; i++){
+                    const TextureLayer& texture = level.bodies[i]->texture();
+                    level.bodies[i]->instance(level.instances[i], dt, origin);
+                    level.instances[i].layer = bodyTextures().isReady(texture.id) ? (float)texture.layer : -1.0f;
+                }
+            });
+
+            upload(level);
+        }
+
+        //orphans the old storage so the driver never has to wait for last frame's draw to finish reading it
+        void upload(Level& level){
+
+            size_t count = level.instances.size();
+            glBindBuffer(GL_ARRAY_BUFFER, level.instanceVBO);
+
+            if(count > level.capacity){
+                //grow geometrically, a buffer that keeps its size lets the driver recycle the orphaned storage
+                level.capacity = std::max(count, level.capacity * 2);
+            }
+            glBufferData(GL_ARRAY_BUFFER, level.capacity * sizeof(BodyInstance), nullptr, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, count * sizeof(BodyInstance), level.instances.data());
+
+            glBindBuffer(GL_ARRAY_BUFFER, 0);
+        }
+};
+
+#endif
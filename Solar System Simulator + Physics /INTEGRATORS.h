@@ -0,0 +1,377 @@
+#ifndef INTEGRATORS_H
+#define INTEGRATORS_H
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+#include "KEPLER.h"
+#include "THREAD_POOL.h"
+
+//Symplectic integrators. Each one is a policy with a static step() templated on the system, so
+//NBodySystem::stepWith<Integrator> compiles the whole kick/drift sequence into one specialized step.
+//All of them assume the accelerations are valid on entry and leave them valid on exit, so the
+//force evaluation at the end of a step is reused at the start of the next (first same as last).
+
+enum class IntegratorType{
+    LEAPFROG,
+    YOSHIDA4,
+    WISDOM_HOLMAN,
+    BLOCK_LEAPFROG
+};
+
+const int INTEGRATOR_COUNT = 4;
+
+//bodies per task for the Kepler drift, each body costs a Newton solve
+const int KEPLER_CHUNK = 2048;
+
+//finest block level, the smallest step a body can get is dt / 2^MAX_BLOCK_LEVEL
+const int MAX_BLOCK_LEVEL = 10;
+//block step accuracy, a circular orbit gets about 2*pi/BLOCK_ETA steps per revolution
+const float BLOCK_ETA = 0.05f;
+
+//kick-drift-kick leapfrog: 2nd order, one force evaluation per step
+struct Leapfrog{
+
+    static const char* name(){ return "LEAPFROG"; }
+
+    template<class System>
+    static void step(System& sys, float dt){
+        sys.kick(0.5f * dt);
+        sys.drift(dt);
+        sys.computeAccelerations();
+        sys.kick(0.5f * dt);
+    }
+};
+
+//Yoshida's 4th order scheme: three leapfrog substeps with weights w1, w0, w1,
+//neighbouring half kicks merged, three force evaluations per step
+struct Yoshida4{
+
+    static const char* name(){ return "YOSHIDA-4"; }
+
+    template<class System>
+    static void step(System& sys, float dt){
+
+        const double cbrt2 = std::cbrt(2.0);
+        const float w1 = (float)(1.0 / (2.0 - cbrt2));
+        const float w0 = (float)(-cbrt2 / (2.0 - cbrt2));
+
+        sys.kick(0.5f * w1 * dt);
+        sys.drift(w1 * dt);
+        sys.computeAccelerations();
+        sys.kick(0.5f * (w1 + w0) * dt);
+        sys.drift(w0 * dt);
+        sys.computeAccelerations();
+        sys.kick(0.5f * (w0 + w1) * dt);
+        sys.drift(w1 * dt);
+        sys.computeAccelerations();
+        sys.kick(0.5f * w1 * dt);
+    }
+};
+
+//Wisdom-Holman mapping: the drift moves every body on its exact Kepler orbit around its parent
+//(the sun for planets, the planet for moons), the kick only applies what is left of gravity once
+//that dominant two-body pull is taken out. The leftover is tiny for sun-dominated systems, which
+//is what allows steps around 10x larger than leapfrog for the same error.
+//Works in parent-relative coordinates, a hierarchical form of the original Jacobi split;
+//parents have to come before their children in the body table (addOrbitingBody guarantees it).
+struct WisdomHolman{
+
+    static const char* name(){ return "WISDOM-HOLMAN"; }
+
+    template<class System>
+    static void step(System& sys, float dt){
+        interactionKick(sys, 0.5f * dt);
+        keplerDrift(sys, dt);
+        sys.computeAccelerations();
+        interactionKick(sys, 0.5f * dt);
+    }
+
+    template<class System>
+    static void interactionKick(System& sys, float h){
+
+        auto& b = sys.bodies;
+        const int count = (int)b.size();
+        const float G = sys.G;
+        double* dv = sys.workspace(3 * count);
+
+        //change of each body's velocity relative to its parent. Bodies on rails are placed by the system and
+        //their accelerations aren't kept up to date, they get no change (in case something integrated orbits them)
+        workerPool().parallelFor(0, count, KEPLER_CHUNK, [&](int begin, int end){
+            for(int i = begin; i < end; i++){
+
+                if(sys.isOnRails(i)){
+                    dv[3 * i + 0] = dv[3 * i + 1] = dv[3 * i + 2] = 0.0;
+                    continue;
+                }
+
+                int p = b.parent[i];
+                if(p < 0 || p >= i){
+                    dv[3 * i + 0] = b.ax[i] * h;
+                    dv[3 * i + 1] = b.ay[i] * h;
+                    dv[3 * i + 2] = b.az[i] * h;
+                    continue;
+                }
+
+                double rx = b.x[i] - b.x[p];
+                double ry = b.y[i] - b.y[p];
+                double rz = b.z[i] - b.z[p];
+                double r2 = rx * rx + ry * ry + rz * rz;
+                double mu = (double)G * (b.mass[p] + b.mass[i]);
+                //add back the Kepler pull the drift already accounts for
+                double k = r2 > 0.0 ? mu / (r2 * std::sqrt(r2)) : 0.0;
+
+                dv[3 * i + 0] = ((double)b.ax[i] - b.ax[p] + k * rx) * h;
+                dv[3 * i + 1] = ((double)b.ay[i] - b.ay[p] + k * ry) * h;
+                dv[3 * i + 2] = ((double)b.az[i] - b.az[p] + k * rz) * h;
+            }
+        });
+
+        //top-down, a child inherits its parent's change so only the relative part differs
+        for(int i = 0; i < count; i++){
+            int p = b.parent[i];
+            if(p >= 0 && p < i && !sys.isOnRails(i)){
+                dv[3 * i + 0] += dv[3 * p + 0];
+                dv[3 * i + 1] += dv[3 * p + 1];
+                dv[3 * i + 2] += dv[3 * p + 2];
+            }
+        }
+
+        workerPool().parallelFor(0, count, KEPLER_CHUNK * 4, [&](int begin, int end){
+            for(int i = begin; i < end; i++){
+                if(sys.isOnRails(i))
+                    continue;
+                b.vx[i] += dv[3 * i + 0];
+                b.vy[i] += dv[3 * i + 1];
+                b.vz[i] += dv[3 * i + 2];
+            }
+        });
+    }
+
+    template<class System>
+    static void keplerDrift(System& sys, float h){
+
+        auto& b = sys.bodies;
+        const int count = (int)b.size();
+        const float G = sys.G;
+        //relative position and velocity after the drift, 6 doubles per body
+        double* rel = sys.workspace(6 * count);
+
+        workerPool().parallelFor(0, count, KEPLER_CHUNK, [&](int begin, int end){
+            for(int i = begin; i < end; i++){
+
+                //bodies on rails get placed by the system afterwards
+                if(sys.isOnRails(i))
+                    continue;
+
+                double* r = rel + 6 * i;
+                double* v = r + 3;
+                int p = b.parent[i];
+
+                if(p < 0 || p >= i){
+                    //roots just coast, stored as absolute state
+                    r[0] = b.x[i] + b.vx[i] * h;
+                    r[1] = b.y[i] + b.vy[i] * h;
+                    r[2] = b.z[i] + b.vz[i] * h;
+                    v[0] = b.vx[i]; v[1] = b.vy[i]; v[2] = b.vz[i];
+                    continue;
+                }
+
+                r[0] = b.x[i] - b.x[p];
+                r[1] = b.y[i] - b.y[p];
+                r[2] = b.z[i] - b.z[p];
+                v[0] = b.vx[i] - b.vx[p];
+                v[1] = b.vy[i] - b.vy[p];
+                v[2] = b.vz[i] - b.vz[p];
+
+                double mu = (double)G * (b.mass[p] + b.mass[i]);
+                if(!::keplerDrift(r, v, mu, h)){
+                    r[0] += v[0] * h;
+                    r[1] += v[1] * h;
+                    r[2] += v[2] * h;
+                }
+            }
+        });
+
+        //rebuild absolute coordinates top-down, parents are already moved when their children get here
+        for(int i = 0; i < count; i++){
+
+            if(sys.isOnRails(i))
+                continue;
+
+            const double* r = rel + 6 * i;
+            const double* v = r + 3;
+            int p = b.parent[i];
+
+            if(p < 0 || p >= i){
+                b.x[i] = r[0]; b.y[i] = r[1]; b.z[i] = r[2];
+                continue;
+            }
+
+            b.x[i] = b.x[p] + r[0];
+            b.y[i] = b.y[p] + r[1];
+            b.z[i] = b.z[p] + r[2];
+            b.vx[i] = b.vx[p] + v[0];
+            b.vy[i] = b.vy[p] + v[1];
+            b.vz[i] = b.vz[p] + v[2];
+        }
+    }
+};
+
+//Bookkeeping for BlockLeapfrog, owned by the system so nothing is reallocated between steps.
+struct BlockTimesteps{
+
+    //each body steps with dt / 2^level
+    std::vector<int> level;
+    //bodies grouped by level, rebuilt at the start of every block
+    std::vector<std::vector<int>> buckets;
+    //substep each body was last drifted to
+    std::vector<int> driftedTo;
+    //bodies finishing their step at the current substep
+    std::vector<int> active;
+};
+
+//Hierarchical (block) timesteps: every body gets the largest power-of-two fraction of dt its orbit
+//allows, dt / 2^level, and is only kicked and has its force evaluated on its own level's boundaries.
+//The moon takes many small steps while the planets take one, instead of everything running at the
+//moon's rate. Each body is a KDK leapfrog of its own step size, levels are picked at the start of
+//every block (every dt) from dt_i = BLOCK_ETA * sqrt(r / |a|) relative to the parent.
+//Massive bodies drift every substep so the forces they exert are always current; test particles
+//only drift when they need a force, which is what makes belts cheap.
+struct BlockLeapfrog{
+
+    static const char* name(){ return "BLOCK LEAPFROG"; }
+
+    template<class System>
+    static void step(System& sys, float dt){
+
+        auto& b = sys.bodies;
+        BlockTimesteps& blocks = sys.blocks;
+        const std::vector<int>& sources = sys.sourceIndices();
+
+        const int top = assignLevels(sys, dt);
+        const int substeps = 1 << top;
+        const float dtMin = dt / substeps;
+
+        blocks.driftedTo.assign(b.size(), 0);
+
+        for(int s = 0; s < substeps; s++){
+
+            //levels whose step starts here (s is a multiple of their step), all of them on the first substep
+            int firstStarting = s == 0 ? 0 : top - trailingZeros(s);
+            for(int k = firstStarting; k <= top; k++)
+                kick(b, blocks.buckets[k], 0.5f * levelStep(dt, k));
+
+            for(int i: sources){
+                b.x[i] += b.vx[i] * dtMin;
+                b.y[i] += b.vy[i] * dtMin;
+                b.z[i] += b.vz[i] * dtMin;
+                blocks.driftedTo[i] = s + 1;
+            }
+
+            //levels whose step ends after this substep, every level on the last one
+            int firstEnding = top - trailingZeros(s + 1);
+            blocks.active.clear();
+            for(int k = firstEnding; k <= top; k++)
+                blocks.active.insert(blocks.active.end(), blocks.buckets[k].begin(), blocks.buckets[k].end());
+
+            //catch the test particles up to now, velocity hasn't changed since their opening kick
+            for(int i: blocks.active){
+                float h = (s + 1 - blocks.driftedTo[i]) * dtMin;
+                b.x[i] += b.vx[i] * h;
+                b.y[i] += b.vy[i] * h;
+                b.z[i] += b.vz[i] * h;
+                blocks.driftedTo[i] = s + 1;
+            }
+
+            sys.computeAccelerationsFor(blocks.active);
+
+            for(int k = firstEnding; k <= top; k++)
+                kick(b, blocks.buckets[k], 0.5f * levelStep(dt, k));
+        }
+    }
+
+    static float levelStep(float dt, int level){
+        return dt / (float)(1 << level);
+    }
+
+    static int trailingZeros(int n){
+        int zeros = 0;
+        while(n > 0 && (n & 1) == 0){
+            n >>= 1;
+            zeros++;
+        }
+        return zeros;
+    }
+
+    template<class Table>
+    static void kick(Table& b, const std::vector<int>& bucket, float h){
+        workerPool().parallelFor(0, (int)bucket.size(), KEPLER_CHUNK * 4, [&](int begin, int end){
+            for(int n = begin; n < end; n++){
+                int i = bucket[n];
+                b.vx[i] += b.ax[i] * h;
+                b.vy[i] += b.ay[i] * h;
+                b.vz[i] += b.az[i] * h;
+            }
+        });
+    }
+
+    //puts every body in its bucket from the accelerations left by the previous block, returns the finest level in use
+    template<class System>
+    static int assignLevels(System& sys, float dt){
+
+        auto& b = sys.bodies;
+        BlockTimesteps& blocks = sys.blocks;
+        const int count = (int)b.size();
+
+        blocks.level.resize(count);
+        workerPool().parallelFor(0, count, KEPLER_CHUNK, [&](int begin, int end){
+            for(int i = begin; i < end; i++){
+
+                int p = b.parent[i];
+                blocks.level[i] = 0;
+                //roots have nothing to measure against and move slowest anyway
+                if(p < 0)
+                    continue;
+
+                double rx = b.x[i] - b.x[p], ry = b.y[i] - b.y[p], rz = b.z[i] - b.z[p];
+                float ax = b.ax[i] - b.ax[p], ay = b.ay[i] - b.ay[p], az = b.az[i] - b.az[p];
+                float r = std::sqrt(rx * rx + ry * ry + rz * rz);
+                float a = std::sqrt(ax * ax + ay * ay + az * az);
+                if(a <= 0.0f)
+                    continue;
+
+                float wanted = BLOCK_ETA * std::sqrt(r / a);
+                int level = 0;
+                while(level < MAX_BLOCK_LEVEL && levelStep(dt, level) > wanted)
+                    level++;
+                blocks.level[i] = level;
+            }
+        });
+
+        int top = 0;
+        blocks.buckets.resize(MAX_BLOCK_LEVEL + 1);
+        for(auto &bucket: blocks.buckets)
+            bucket.clear();
+        for(int i = 0; i < count; i++){
+            //bodies on rails aren't integrated at all
+            if(sys.isOnRails(i))
+                continue;
+            blocks.buckets[blocks.level[i]].push_back(i);
+            top = std::max(top, blocks.level[i]);
+        }
+        return top;
+    }
+};
+
+inline const char* integratorName(IntegratorType type){
+    switch(type){
+        case IntegratorType::BLOCK_LEAPFROG: return BlockLeapfrog::name();
+        case IntegratorType::YOSHIDA4: return Yoshida4::name();
+        case IntegratorType::WISDOM_HOLMAN: return WisdomHolman::name();
+        default: return Leapfrog::name();
+    }
+}
+
+#endif
@@ -0,0 +1,622 @@
+#ifndef KEPLER_H
+#define KEPLER_H
+
+#include <cmath>
+#include <algorithm>
+#include <vector>
+
+#include "SIMD_GRAVITY.h"
+
+//Two-body propagation in universal variables: moves a body on its exact conic around a point mass
+//for any dt, elliptic, parabolic or hyperbolic alike, without stepping.
+//Everything is done in double, the inputs are usually differences of nearby positions.
+
+//Stumpff functions C(z) and S(z), switching to their series close to 0 where the closed forms cancel out
+inline void stumpff(double z, double& C, double& S){
+
+    if(z > 1e-4){
+        double s = std::sqrt(z);
+        C = (1.0 - std::cos(s)) / z;
+        S = (s - std::sin(s)) / (s * z);
+    }
+    else if(z < -1e-4){
+        double s = std::sqrt(-z);
+        C = (std::cosh(s) - 1.0) / -z;
+        S = (std::sinh(s) - s) / (s * -z);
+    }
+    else{
+        C = 1.0 / 2.0 - z / 24.0 + z * z / 720.0;
+        S = 1.0 / 6.0 - z / 120.0 + z * z / 5040.0;
+    }
+}
+
+//Newton solve of the universal Kepler equation for the universal anomaly chi after dt.
+//r0 is the starting distance, sigma0 = r.v / sqrt(mu), alpha = 1/a. 'chi' holds the first guess on entry
+//and the answer on exit, 'rNew' the distance after dt, C and S the Stumpff values at the answer.
+inline bool solveUniversalAnomaly(double r0, double sigma0, double alpha, double sqrtMu, double dt,
+                                  double& chi, double& rNew, double& C, double& S){
+
+    double z = 0.0;
+    C = 0.5;
+    S = 1.0 / 6.0;
+    rNew = r0;
+
+    for(int iter = 0; iter < 50; iter++){
+
+        z = alpha * chi * chi;
+        stumpff(z, C, S);
+
+        double chi2 = chi * chi;
+        double F = sigma0 * chi2 * C + (1.0 - alpha * r0) * chi2 * chi * S + r0 * chi - sqrtMu * dt;
+        //dF/dchi is the new radius
+        rNew = sigma0 * chi * (1.0 - z * S) + (1.0 - alpha * r0) * chi2 * C + r0;
+
+        double delta = F / rNew;
+        chi -= delta;
+        if(std::fabs(delta) <= 1e-12 * std::max(1.0, std::fabs(chi))){
+            if(!std::isfinite(chi))
+                return false;
+            z = alpha * chi * chi;
+            stumpff(z, C, S);
+            rNew = sigma0 * chi * (1.0 - z * S) + (1.0 - alpha * r0) * chi * chi * C + r0;
+            return true;
+        }
+    }
+    return false;
+}
+
+//Lagrange f and g coefficients: maps the state (r, v) at the start onto the state after dt
+inline void applyLagrange(const double r[3], const double v[3], double r0, double rNew, double sqrtMu, double alpha,
+                          double chi, double C, double S, double dt, double outR[3], double outV[3]){
+
+    double chi2 = chi * chi;
+    double z = alpha * chi2;
+
+    double f = 1.0 - chi2 / r0 * C;
+    double g = dt - chi2 * chi / sqrtMu * S;
+    double fDot = sqrtMu / (rNew * r0) * (z * S - 1.0) * chi;
+    double gDot = 1.0 - chi2 / rNew * C;
+
+    for(int k = 0; k < 3; k++){
+        double rn = f * r[k] + g * v[k];
+        double vn = fDot * r[k] + gDot * v[k];
+        outR[k] = rn;
+        outV[k] = vn;
+    }
+}
+
+//advances relative position r and velocity v (in place) around a mass with gravitational parameter mu = G*(m1+m2)
+//returns false if Newton didn't converge, r and v are left unchanged in that case
+inline bool keplerDrift(double r[3], double v[3], double mu, double dt){
+
+    if(mu <= 0.0 || dt == 0.0){
+        r[0] += v[0] * dt;
+        r[1] += v[1] * dt;
+        r[2] += v[2] * dt;
+        return true;
+    }
+
+    const double r0 = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+    if(r0 <= 0.0)
+        return false;
+
+    const double v2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+    const double rv = r[0] * v[0] + r[1] * v[1] + r[2] * v[2];
+    const double sqrtMu = std::sqrt(mu);
+    //reciprocal semi-major axis, > 0 elliptic, 0 parabolic, < 0 hyperbolic
+    const double alpha = 2.0 / r0 - v2 / mu;
+
+    //initial guess: exact for circular orbits, reasonable otherwise
+    double chi;
+    if(alpha > 1e-12)
+        chi = sqrtMu * dt * alpha;
+    else
+        chi = sqrtMu * dt / r0;
+
+    double rNew, C, S;
+    if(!solveUniversalAnomaly(r0, rv / sqrtMu, alpha, sqrtMu, dt, chi, rNew, C, S))
+        return false;
+
+    applyLagrange(r, v, r0, rNew, sqrtMu, alpha, chi, C, S, dt, r, v);
+    return true;
+}
+
+//rotates (c, s) = (cos E, sin E) by a small angle d, |d| < KEPLER_SMALL_ANGLE, with truncated series
+//accurate to ~1e-13, so frame-to-frame updates need no trig calls at all
+const double KEPLER_SMALL_ANGLE = 0.1;
+//eccentric anomaly error accepted on the warm path, radians
+const double KEPLER_TOLERANCE = 1e-12;
+
+inline void rotateSmallAngle(double& c, double& s, double d){
+    double d2 = d * d;
+    double cd = 1.0 - d2 * (1.0 / 2.0 - d2 * (1.0 / 24.0 - d2 / 720.0));
+    double sd = d * (1.0 - d2 * (1.0 / 6.0 - d2 * (1.0 / 120.0 - d2 / 5040.0)));
+    double cn = c * cd - s * sd;
+    double sn = s * cd + c * sd;
+    //pull back onto the unit circle so rounding can't build up
+    double k = 1.5 - 0.5 * (cn * cn + sn * sn);
+    c = cn * k;
+    s = sn * k;
+}
+
+//Conics evaluated in closed form at any time from a fixed epoch state, no stepping and no drift in energy.
+//Stored as structure of arrays, everything the solve needs is precomputed when an orbit is added.
+//Bound orbits are kept as orbital elements and solved in the eccentric anomaly E. Each one remembers
+//cos E and sin E from its last evaluation: frames are close together in time, so the next E is reached
+//by rotating those with a small-angle series, two Newton corrections and no trig calls.
+//Unbound orbits, big jumps in time and a full period wrapping around go through the universal-variable solver.
+struct KeplerOrbits{
+
+    //state relative to the central body at the epoch
+    std::vector<double> rx, ry, rz, vx, vy, vz;
+    std::vector<double> epoch;
+    std::vector<double> r0, sigma0, alpha, sqrtMu;
+    //0 for unbound orbits
+    std::vector<double> period;
+
+    //elements of bound orbits: eccentricity, mean motion, mean anomaly at the epoch, and the semi-major
+    //and semi-minor axes as vectors, a times the periapsis direction P and b times Q, 90 degrees ahead of it
+    std::vector<double> e, n, meanAnomaly0;
+    std::vector<double> majorX, majorY, majorZ, minorX, minorY, minorZ;
+
+    //warm start, lastTau < 0 means none yet
+    std::vector<double> lastTau, lastE, cosE, sinE;
+
+    int add(const double r[3], const double v[3], double mu, double epochTime){
+
+        double dist = std::sqrt(r[0] * r[0] + r[1] * r[1] + r[2] * r[2]);
+        double v2 = v[0] * v[0] + v[1] * v[1] + v[2] * v[2];
+        double rv = r[0] * v[0] + r[1] * v[1] + r[2] * v[2];
+        double root = std::sqrt(mu);
+        double inverseA = 2.0 / dist - v2 / mu;
+
+        rx.push_back(r[0]); ry.push_back(r[1]); rz.push_back(r[2]);
+        vx.push_back(v[0]); vy.push_back(v[1]); vz.push_back(v[2]);
+        epoch.push_back(epochTime);
+        r0.push_back(dist);
+        sigma0.push_back(rv / root);
+        alpha.push_back(inverseA);
+        sqrtMu.push_back(root);
+
+        double P[3] = {r[0] / dist, r[1] / dist, r[2] / dist};
+        double Q[3] = {0.0, 0.0, 0.0};
+        double semiMajor = 0.0, ecc = 0.0, motion = 0.0, M0 = 0.0;
+
+        if(inverseA > 1e-12){
+
+            semiMajor = 1.0 / inverseA;
+            motion = root * inverseA * std::sqrt(inverseA);
+
+            //eccentricity vector points at periapsis, near-circular orbits measure from the epoch position instead
+            double ev[3];
+            for(int k = 0; k < 3; k++)
+                ev[k] = ((v2 - mu / dist) * r[k] - rv * v[k]) / mu;
+            ecc = std::sqrt(ev[0] * ev[0] + ev[1] * ev[1] + ev[2] * ev[2]);
+            if(ecc > 1e-9)
+                for(int k = 0; k < 3; k++)
+                    P[k] = ev[k] / ecc;
+
+            //Q = h x P, h the unit angular momentum
+            double h[3] = {r[1] * v[2] - r[2] * v[1], r[2] * v[0] - r[0] * v[2], r[0] * v[1] - r[1] * v[0]};
+            double hLen = std::sqrt(h[0] * h[0] + h[1] * h[1] + h[2] * h[2]);
+            if(hLen > 0.0 && ecc < 1.0){
+                for(int k = 0; k < 3; k++)
+                    h[k] /= hLen;
+                Q[0] = h[1] * P[2] - h[2] * P[1];
+                Q[1] = h[2] * P[0] - h[0] * P[2];
+                Q[2] = h[0] * P[1] - h[1] * P[0];
+
+                double x = r[0] * P[0] + r[1] * P[1] + r[2] * P[2];
+                double y = r[0] * Q[0] + r[1] * Q[1] + r[2] * Q[2];
+                double E0 = std::atan2(y / (semiMajor * std::sqrt(1.0 - ecc * ecc)), x / semiMajor + ecc);
+                M0 = E0 - ecc * std::sin(E0);
+            }
+            else{
+                //radial orbit, no plane to speak of, universal variables only
+                inverseA = 0.0;
+            }
+        }
+
+        double semiMinor = semiMajor * std::sqrt(std::max(1.0 - ecc * ecc, 0.0));
+        e.push_back(ecc);
+        n.push_back(motion);
+        meanAnomaly0.push_back(M0);
+        majorX.push_back(semiMajor * P[0]); majorY.push_back(semiMajor * P[1]); majorZ.push_back(semiMajor * P[2]);
+        minorX.push_back(semiMinor * Q[0]); minorY.push_back(semiMinor * Q[1]); minorZ.push_back(semiMinor * Q[2]);
+        period.push_back(inverseA > 1e-12 ? 6.283185307179586 / motion : 0.0);
+
+        lastTau.push_back(-1.0);
+        lastE.push_back(0.0);
+        cosE.push_back(1.0);
+        sinE.push_back(0.0);
+
+        return (int)rx.size() - 1;
+    }
+
+    //moves the last orbit into slot k, returns its old index so the owner can fix its references
+    int removeSwap(int k){
+
+        int last = (int)rx.size() - 1;
+        auto move = [k, last](std::vector<double>& array){ array[k] = array[last]; array.pop_back(); };
+        move(rx); move(ry); move(rz);
+        move(vx); move(vy); move(vz);
+        move(epoch);
+        move(r0); move(sigma0); move(alpha); move(sqrtMu);
+        move(period);
+        move(e); move(n); move(meanAnomaly0);
+        move(majorX); move(majorY); move(majorZ); move(minorX); move(minorY); move(minorZ);
+        move(lastTau); move(lastE); move(cosE); move(sinE);
+        return last;
+    }
+
+    size_t size() const {
+        return rx.size();
+    }
+
+    //relative position and velocity of orbit k at time t
+    bool evaluate(int k, double t, double r[3], double v[3]){
+
+        if(period[k] <= 0.0)
+            return evaluateUniversal(k, t - epoch[k], r, v);
+        if(evaluateWarm(k, t, r, v))
+            return true;
+
+        const double tau = boundTau(k, t);
+        const double ecc = e[k];
+        const double M = meanAnomaly0[k] + n[k] * tau;
+
+        double E = M + ecc * std::sin(M);
+        for(int iter = 0; iter < 50; iter++){
+            double d = (M - (E - ecc * std::sin(E))) / (1.0 - ecc * std::cos(E));
+            E += d;
+            if(std::fabs(d) < 1e-13)
+                break;
+        }
+
+        lastTau[k] = tau;
+        lastE[k] = E;
+        cosE[k] = std::cos(E);
+        sinE[k] = std::sin(E);
+        fromAnomaly(k, cosE[k], sinE[k], r, v);
+        return true;
+    }
+
+    //Only the warm path of a bound orbit: Newton on E - e sin E = M from the last evaluation's E.
+    //False, with nothing changed, when the orbit needs the full solve
+    bool evaluateWarm(int k, double t, double r[3], double v[3]){
+
+        const double tau = boundTau(k, t);
+        if(period[k] <= 0.0 || lastTau[k] < 0.0 || tau < lastTau[k])
+            return false;
+
+        const double ecc = e[k];
+        const double M = meanAnomaly0[k] + n[k] * tau;
+        double E = lastE[k];
+        double c = cosE[k];
+        double s = sinE[k];
+
+        for(int iter = 0; iter < 3; iter++){
+            double d = (M - (E - ecc * s)) / (1.0 - ecc * c);
+            if(std::fabs(d) > KEPLER_SMALL_ANGLE)
+                return false;
+            rotateSmallAngle(c, s, d);
+            E += d;
+            //what is left after this step is on the order of e*d^2, far below float positions
+            if(ecc * d * d < KEPLER_TOLERANCE)
+                break;
+        }
+        if(!(std::fabs(M - (E - ecc * s)) <= 1e3 * KEPLER_TOLERANCE))
+            return false;
+
+        lastTau[k] = tau;
+        lastE[k] = E;
+        cosE[k] = c;
+        sinE[k] = s;
+        fromAnomaly(k, c, s, r, v);
+        return true;
+    }
+
+    //time since the epoch; bound orbits repeat, keeping tau within one period keeps the anomalies small
+    double boundTau(int k, double t) const {
+        double tau = t - epoch[k];
+        if(period[k] > 0.0 && (tau < 0.0 || tau >= period[k]))
+            tau -= period[k] * std::floor(tau / period[k]);
+        return tau;
+    }
+
+    //state of a bound orbit from cos E and sin E
+    void fromAnomaly(int k, double c, double s, double r[3], double v[3]) const {
+
+        //r = (cos E - e) A + sin E B, and dE/dt = n / (1 - e cos E)
+        const double x = c - e[k];
+        const double rate = n[k] / (1.0 - e[k] * c);
+        const double vxPlane = -s * rate;
+        const double vyPlane = c * rate;
+
+        r[0] = x * majorX[k] + s * minorX[k];
+        r[1] = x * majorY[k] + s * minorY[k];
+        r[2] = x * majorZ[k] + s * minorZ[k];
+        v[0] = vxPlane * majorX[k] + vyPlane * minorX[k];
+        v[1] = vxPlane * majorY[k] + vyPlane * minorY[k];
+        v[2] = vxPlane * majorZ[k] + vyPlane * minorZ[k];
+    }
+
+    bool evaluateUniversal(int k, double tau, double r[3], double v[3]){
+
+        double chi = alpha[k] > 1e-12 ? sqrtMu[k] * tau * alpha[k] : sqrtMu[k] * tau / r0[k];
+        double rNew, C, S;
+        if(!solveUniversalAnomaly(r0[k], sigma0[k], alpha[k], sqrtMu[k], tau, chi, rNew, C, S))
+            return false;
+
+        const double start[3] = {rx[k], ry[k], rz[k]};
+        const double startV[3] = {vx[k], vy[k], vz[k]};
+        applyLagrange(start, startV, r0[k], rNew, sqrtMu[k], alpha[k], chi, C, S, tau, r, v);
+        return true;
+    }
+};
+
+//A run of orbits evaluated in one go: relative states by position in the run, and which ones the warm
+//path couldn't do (unbound, cold or too far from their last evaluation) and still need evaluate()
+struct KeplerBlock{
+
+    static const int SIZE = 128;
+    double rx[SIZE], ry[SIZE], rz[SIZE];
+    double vx[SIZE], vy[SIZE], vz[SIZE];
+    unsigned char cold[SIZE];
+};
+
+//The warm path for orbits [first, first + count) into 'out', in scalar, AVX2 and AVX-512 flavours picked
+//at runtime like the gravity kernels. Every lane does the same Newton steps on its own E, so the wide
+//versions run the whole solve across orbits and only mask out the lanes that are done or go cold
+struct KeplerKernels{
+
+    SimdLevel level;
+    const char* name;
+
+    void (*warm)(KeplerOrbits& orbits, int first, int count, double t, KeplerBlock& out);
+};
+
+inline void keplerWarmRangeScalar(KeplerOrbits& o, int first, int begin, int end, double t, KeplerBlock& out){
+
+    for(int j = begin; j < end; j++){
+        double r[3], v[3];
+        out.cold[j] = !o.evaluateWarm(first + j, t, r, v);
+        //a cold orbit left r and v alone, the caller evaluates it again anyway
+        if(out.cold[j])
+            continue;
+        out.rx[j] = r[0]; out.ry[j] = r[1]; out.rz[j] = r[2];
+        out.vx[j] = v[0]; out.vy[j] = v[1]; out.vz[j] = v[2];
+    }
+}
+
+inline void keplerWarmScalar(KeplerOrbits& o, int first, int count, double t, KeplerBlock& out){
+    keplerWarmRangeScalar(o, first, 0, count, t, out);
+}
+
+#ifdef GRAVITY_X86
+
+//rotateSmallAngle on four lanes
+__attribute__((target("avx2,fma")))
+inline void rotateSmallAngle256(__m256d& c, __m256d& s, __m256d d){
+
+    const __m256d one = _mm256_set1_pd(1.0);
+    __m256d d2 = _mm256_mul_pd(d, d);
+    __m256d cd = _mm256_fnmadd_pd(d2, _mm256_set1_pd(1.0 / 720.0), _mm256_set1_pd(1.0 / 24.0));
+    cd = _mm256_fnmadd_pd(d2, cd, _mm256_set1_pd(0.5));
+    cd = _mm256_fnmadd_pd(d2, cd, one);
+    __m256d sd = _mm256_fnmadd_pd(d2, _mm256_set1_pd(1.0 / 5040.0), _mm256_set1_pd(1.0 / 120.0));
+    sd = _mm256_fnmadd_pd(d2, sd, _mm256_set1_pd(1.0 / 6.0));
+    sd = _mm256_mul_pd(d, _mm256_fnmadd_pd(d2, sd, one));
+
+    __m256d cn = _mm256_fmsub_pd(c, cd, _mm256_mul_pd(s, sd));
+    __m256d sn = _mm256_fmadd_pd(s, cd, _mm256_mul_pd(c, sd));
+    __m256d k = _mm256_fnmadd_pd(_mm256_set1_pd(0.5), _mm256_fmadd_pd(cn, cn, _mm256_mul_pd(sn, sn)), _mm256_set1_pd(1.5));
+    c = _mm256_mul_pd(cn, k);
+    s = _mm256_mul_pd(sn, k);
+}
+
+__attribute__((target("avx2,fma")))
+inline void keplerWarmAVX2(KeplerOrbits& o, int first, int count, double t, KeplerBlock& out){
+
+    const __m256d zero = _mm256_setzero_pd();
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d signBit = _mm256_set1_pd(-0.0);
+    const __m256d smallAngle = _mm256_set1_pd(KEPLER_SMALL_ANGLE);
+    const __m256d tolerance = _mm256_set1_pd(KEPLER_TOLERANCE);
+    const __m256d residualTolerance = _mm256_set1_pd(1e3 * KEPLER_TOLERANCE);
+    const __m256d now = _mm256_set1_pd(t);
+    const int wide = count & ~3;
+
+    for(int j = 0; j < wide; j += 4){
+
+        const int k = first + j;
+        __m256d period = _mm256_loadu_pd(&o.period[k]);
+        __m256d bound = _mm256_cmp_pd(period, zero, _CMP_GT_OQ);
+        //unbound lanes divide by 1 instead of 0, they go cold anyway
+        __m256d safePeriod = _mm256_blendv_pd(one, period, bound);
+
+        __m256d tau = _mm256_sub_pd(now, _mm256_loadu_pd(&o.epoch[k]));
+        __m256d outside = _mm256_or_pd(_mm256_cmp_pd(tau, zero, _CMP_LT_OQ), _mm256_cmp_pd(tau, safePeriod, _CMP_GE_OQ));
+        __m256d wrapped = _mm256_fnmadd_pd(safePeriod, _mm256_floor_pd(_mm256_div_pd(tau, safePeriod)), tau);
+        tau = _mm256_blendv_pd(tau, wrapped, outside);
+
+        __m256d ecc = _mm256_loadu_pd(&o.e[k]);
+        __m256d M = _mm256_fmadd_pd(_mm256_loadu_pd(&o.n[k]), tau, _mm256_loadu_pd(&o.meanAnomaly0[k]));
+        __m256d E = _mm256_loadu_pd(&o.lastE[k]);
+        __m256d c = _mm256_loadu_pd(&o.cosE[k]);
+        __m256d s = _mm256_loadu_pd(&o.sinE[k]);
+        __m256d last = _mm256_loadu_pd(&o.lastTau[k]);
+
+        __m256d warm = _mm256_and_pd(bound, _mm256_and_pd(_mm256_cmp_pd(last, zero, _CMP_GE_OQ), _mm256_cmp_pd(tau, last, _CMP_GE_OQ)));
+        //lanes still iterating
+        __m256d active = warm;
+
+        for(int iter = 0; iter < 3 && _mm256_movemask_pd(active); iter++){
+
+            __m256d d = _mm256_div_pd(_mm256_sub_pd(M, _mm256_fnmadd_pd(ecc, s, E)), _mm256_fnmadd_pd(ecc, c, one));
+            __m256d tooFar = _mm256_cmp_pd(_mm256_andnot_pd(signBit, d), smallAngle, _CMP_GT_OQ);
+            warm = _mm256_andnot_pd(_mm256_and_pd(active, tooFar), warm);
+            active = _mm256_andnot_pd(tooFar, active);
+
+            __m256d rotatedC = c, rotatedS = s;
+            rotateSmallAngle256(rotatedC, rotatedS, d);
+            c = _mm256_blendv_pd(c, rotatedC, active);
+            s = _mm256_blendv_pd(s, rotatedS, active);
+            E = _mm256_add_pd(E, _mm256_and_pd(d, active));
+
+            __m256d converged = _mm256_cmp_pd(_mm256_mul_pd(ecc, _mm256_mul_pd(d, d)), tolerance, _CMP_LT_OQ);
+            active = _mm256_andnot_pd(converged, active);
+        }
+
+        __m256d residual = _mm256_andnot_pd(signBit, _mm256_sub_pd(M, _mm256_fnmadd_pd(ecc, s, E)));
+        warm = _mm256_and_pd(warm, _mm256_cmp_pd(residual, residualTolerance, _CMP_LE_OQ));
+
+        __m256d x = _mm256_sub_pd(c, ecc);
+        __m256d rate = _mm256_div_pd(_mm256_loadu_pd(&o.n[k]), _mm256_fnmadd_pd(ecc, c, one));
+        __m256d vxPlane = _mm256_mul_pd(s, _mm256_sub_pd(zero, rate));
+        __m256d vyPlane = _mm256_mul_pd(c, rate);
+
+        __m256d major = _mm256_loadu_pd(&o.majorX[k]), minor = _mm256_loadu_pd(&o.minorX[k]);
+        _mm256_storeu_pd(out.rx + j, _mm256_fmadd_pd(x, major, _mm256_mul_pd(s, minor)));
+        _mm256_storeu_pd(out.vx + j, _mm256_fmadd_pd(vxPlane, major, _mm256_mul_pd(vyPlane, minor)));
+        major = _mm256_loadu_pd(&o.majorY[k]); minor = _mm256_loadu_pd(&o.minorY[k]);
+        _mm256_storeu_pd(out.ry + j, _mm256_fmadd_pd(x, major, _mm256_mul_pd(s, minor)));
+        _mm256_storeu_pd(out.vy + j, _mm256_fmadd_pd(vxPlane, major, _mm256_mul_pd(vyPlane, minor)));
+        major = _mm256_loadu_pd(&o.majorZ[k]); minor = _mm256_loadu_pd(&o.minorZ[k]);
+        _mm256_storeu_pd(out.rz + j, _mm256_fmadd_pd(x, major, _mm256_mul_pd(s, minor)));
+        _mm256_storeu_pd(out.vz + j, _mm256_fmadd_pd(vxPlane, major, _mm256_mul_pd(vyPlane, minor)));
+
+        //the state only moves on for the lanes that are done
+        __m256i keep = _mm256_castpd_si256(warm);
+        _mm256_maskstore_pd(&o.lastTau[k], keep, tau);
+        _mm256_maskstore_pd(&o.lastE[k], keep, E);
+        _mm256_maskstore_pd(&o.cosE[k], keep, c);
+        _mm256_maskstore_pd(&o.sinE[k], keep, s);
+
+        int done = _mm256_movemask_pd(warm);
+        for(int l = 0; l < 4; l++)
+            out.cold[j + l] = !((done >> l) & 1);
+    }
+
+    keplerWarmRangeScalar(o, first, wide, count, t, out);
+}
+
+__attribute__((target("avx512f")))
+inline void rotateSmallAngle512(__m512d& c, __m512d& s, __m512d d){
+
+    const __m512d one = _mm512_set1_pd(1.0);
+    __m512d d2 = _mm512_mul_pd(d, d);
+    __m512d cd = _mm512_fnmadd_pd(d2, _mm512_set1_pd(1.0 / 720.0), _mm512_set1_pd(1.0 / 24.0));
+    cd = _mm512_fnmadd_pd(d2, cd, _mm512_set1_pd(0.5));
+    cd = _mm512_fnmadd_pd(d2, cd, one);
+    __m512d sd = _mm512_fnmadd_pd(d2, _mm512_set1_pd(1.0 / 5040.0), _mm512_set1_pd(1.0 / 120.0));
+    sd = _mm512_fnmadd_pd(d2, sd, _mm512_set1_pd(1.0 / 6.0));
+    sd = _mm512_mul_pd(d, _mm512_fnmadd_pd(d2, sd, one));
+
+    __m512d cn = _mm512_fmsub_pd(c, cd, _mm512_mul_pd(s, sd));
+    __m512d sn = _mm512_fmadd_pd(s, cd, _mm512_mul_pd(c, sd));
+    __m512d k = _mm512_fnmadd_pd(_mm512_set1_pd(0.5), _mm512_fmadd_pd(cn, cn, _mm512_mul_pd(sn, sn)), _mm512_set1_pd(1.5));
+    c = _mm512_mul_pd(cn, k);
+    s = _mm512_mul_pd(sn, k);
+}
+
+__attribute__((target("avx512f")))
+inline void keplerWarmAVX512(KeplerOrbits& o, int first, int count, double t, KeplerBlock& out){
+
+    const __m512d zero = _mm512_setzero_pd();
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d smallAngle = _mm512_set1_pd(KEPLER_SMALL_ANGLE);
+    const __m512d tolerance = _mm512_set1_pd(KEPLER_TOLERANCE);
+    const __m512d residualTolerance = _mm512_set1_pd(1e3 * KEPLER_TOLERANCE);
+    const __m512d now = _mm512_set1_pd(t);
+
+    for(int j = 0; j < count; j += 8){
+
+        //the last partial run is handled with a lane mask instead of a scalar tail
+        const int k = first + j;
+        int remaining = count - j;
+        __mmask8 lanes = remaining >= 8 ? (__mmask8)0xFF : (__mmask8)((1u << remaining) - 1u);
+
+        //masked-off lanes load a period of 0 and go cold with the unbound ones
+        __m512d period = _mm512_maskz_loadu_pd(lanes, &o.period[k]);
+        __mmask8 bound = _mm512_cmp_pd_mask(period, zero, _CMP_GT_OQ);
+        __m512d safePeriod = _mm512_mask_blend_pd(bound, one, period);
+
+        __m512d tau = _mm512_sub_pd(now, _mm512_maskz_loadu_pd(lanes, &o.epoch[k]));
+        __mmask8 outside = _mm512_cmp_pd_mask(tau, zero, _CMP_LT_OQ) | _mm512_cmp_pd_mask(tau, safePeriod, _CMP_GE_OQ);
+        __m512d cycles = _mm512_roundscale_pd(_mm512_div_pd(tau, safePeriod), _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC);
+        tau = _mm512_mask_blend_pd(outside, tau, _mm512_fnmadd_pd(safePeriod, cycles, tau));
+
+        __m512d ecc = _mm512_maskz_loadu_pd(lanes, &o.e[k]);
+        __m512d M = _mm512_fmadd_pd(_mm512_maskz_loadu_pd(lanes, &o.n[k]), tau, _mm512_maskz_loadu_pd(lanes, &o.meanAnomaly0[k]));
+        __m512d E = _mm512_maskz_loadu_pd(lanes, &o.lastE[k]);
+        __m512d c = _mm512_maskz_loadu_pd(lanes, &o.cosE[k]);
+        __m512d s = _mm512_maskz_loadu_pd(lanes, &o.sinE[k]);
+        __m512d last = _mm512_maskz_loadu_pd(lanes, &o.lastTau[k]);
+
+        __mmask8 warm = bound & _mm512_cmp_pd_mask(last, zero, _CMP_GE_OQ) & _mm512_cmp_pd_mask(tau, last, _CMP_GE_OQ);
+        __mmask8 active = warm;
+
+        for(int iter = 0; iter < 3 && active; iter++){
+
+            __m512d d = _mm512_div_pd(_mm512_sub_pd(M, _mm512_fnmadd_pd(ecc, s, E)), _mm512_fnmadd_pd(ecc, c, one));
+            __mmask8 tooFar = _mm512_cmp_pd_mask(_mm512_abs_pd(d), smallAngle, _CMP_GT_OQ);
+            warm &= ~(active & tooFar);
+            active &= ~tooFar;
+
+            __m512d rotatedC = c, rotatedS = s;
+            rotateSmallAngle512(rotatedC, rotatedS, d);
+            c = _mm512_mask_blend_pd(active, c, rotatedC);
+            s = _mm512_mask_blend_pd(active, s, rotatedS);
+            E = _mm512_mask_add_pd(E, active, E, d);
+
+            active &= ~_mm512_cmp_pd_mask(_mm512_mul_pd(ecc, _mm512_mul_pd(d, d)), tolerance, _CMP_LT_OQ);
+        }
+
+        __m512d residual = _mm512_abs_pd(_mm512_sub_pd(M, _mm512_fnmadd_pd(ecc, s, E)));
+        warm &= _mm512_cmp_pd_mask(residual, residualTolerance, _CMP_LE_OQ);
+
+        __m512d x = _mm512_sub_pd(c, ecc);
+        __m512d rate = _mm512_div_pd(_mm512_maskz_loadu_pd(lanes, &o.n[k]), _mm512_fnmadd_pd(ecc, c, one));
+        __m512d vxPlane = _mm512_mul_pd(s, _mm512_sub_pd(zero, rate));
+        __m512d vyPlane = _mm512_mul_pd(c, rate);
+
+        __m512d major = _mm512_maskz_loadu_pd(lanes, &o.majorX[k]), minor = _mm512_maskz_loadu_pd(lanes, &o.minorX[k]);
+        _mm512_mask_storeu_pd(out.rx + j, lanes, _mm512_fmadd_pd(x, major, _mm512_mul_pd(s, minor)));
+        _mm512_mask_storeu_pd(out.vx + j, lanes, _mm512_fmadd_pd(vxPlane, major, _mm512_mul_pd(vyPlane, minor)));
+        major = _mm512_maskz_loadu_pd(lanes, &o.majorY[k]); minor = _mm512_maskz_loadu_pd(lanes, &o.minorY[k]);
+        _mm512_mask_storeu_pd(out.ry + j, lanes, _mm512_fmadd_pd(x, major, _mm512_mul_pd(s, minor)));
+        _mm512_mask_storeu_pd(out.vy + j, lanes, _mm512_fmadd_pd(vxPlane, major, _mm512_mul_pd(vyPlane, minor)));
+        major = _mm512_maskz_loadu_pd(lanes, &o.majorZ[k]); minor = _mm512_maskz_loadu_pd(lanes, &o.minorZ[k]);
+        _mm512_mask_storeu_pd(out.rz + j, lanes, _mm512_fmadd_pd(x, major, _mm512_mul_pd(s, minor)));
+        _mm512_mask_storeu_pd(out.vz + j, lanes, _mm512_fmadd_pd(vxPlane, major, _mm512_mul_pd(vyPlane, minor)));
+
+        _mm512_mask_storeu_pd(&o.lastTau[k], warm, tau);
+        _mm512_mask_storeu_pd(&o.lastE[k], warm, E);
+        _mm512_mask_storeu_pd(&o.cosE[k], warm, c);
+        _mm512_mask_storeu_pd(&o.sinE[k], warm, s);
+
+        for(int l = 0; l < 8 && l < remaining; l++)
+            out.cold[j + l] = !((warm >> l) & 1);
+    }
+}
+
+#endif
+
+inline KeplerKernels keplerKernelsFor(SimdLevel level){
+#ifdef GRAVITY_X86
+    if(level == SimdLevel::AVX512)
+        return {SimdLevel::AVX512, "AVX-512", keplerWarmAVX512};
+    if(level == SimdLevel::AVX2)
+        return {SimdLevel::AVX2, "AVX2", keplerWarmAVX2};
+#endif
+    return {SimdLevel::SCALAR, "SCALAR", keplerWarmScalar};
+}
+
+//best kernels for this machine, resolved once on first use
+inline const KeplerKernels& keplerKernels(){
+    static const KeplerKernels kernels = keplerKernelsFor(detectSimdLevel());
+    return kernels;
+}
+
+#endif
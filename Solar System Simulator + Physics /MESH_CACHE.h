@@ -0,0 +1,219 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include "TEXTURE_CACHE.h"
+
+//Binary cache of an imported model, next to the texture cache.
+//One file per model: a header, a record per mesh, then the vertex and index arrays exactly as they go into
+//the VBO/EBO and each mesh's material texture list. Loading maps the file and points at the arrays, nothing is parsed.
+//Same validity rules as the texture cache (size and mtime, else contents hash, of the model file itself;
+//materials in a side file like an .obj's .mtl aren't tracked, bump MESH_CACHE_VERSION or clear cache/ after editing one).
+//Vertex arrays are stored raw, so the vertex stride is part of the key and a layout change is a miss.
+//Indices keep whatever width the mesh draws with, 16 or 32 bits.
+const uint32_t MESH_CACHE_VERSION = 2;
+
+struct CachedTexture{
+
+    std::string type;
+    std::string path;
+};
+
+//one mesh as stored; the arrays point into the mapping on load, into the caller's data on store
+struct CachedMesh{
+
+    const unsigned char* vertices = nullptr;
+    uint32_t vertexCount = 0;
+    const void* indices = nullptr;
+    uint32_t indexCount = 0;
+    //bytes per index, 2 or 4
+    uint32_t indexSize = 4;
+    std::vector<CachedTexture> textures;
+};
+
+struct CachedModel{
+
+    std::vector<CachedMesh> meshes;
+    //keeps the arrays above valid
+    std::shared_ptr<MappedFile> file;
+};
+
+struct MeshCacheHeader{
+
+    char magic[4];
+    uint32_t version;
+    uint32_t vertexStride;
+    uint32_t meshCount;
+    //next to sourceMtime, see restampCacheEntry()
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t sourceHash;
+};
+
+//offsets from the start of the file; textures are (length, bytes) strings, type then path
+struct MeshCacheRecord{
+
+    uint64_t vertexOffset, indexOffset, textureOffset;
+    uint32_t vertexCount, indexCount, textureCount, indexSize;
+};
+
+inline std::string meshCachePath(const std::string& source){
+    char name[64];
+    std::snprintf(name, sizeof(name), "%016llx.mesh", (unsigned long long)fnv1a((const unsigned char*)source.data(), source.size()));
+    return std::string(TEXTURE_CACHE_DIR) + "/" + name;
+}
+
+//fills 'model' from a valid entry, false on a miss
+inline bool loadCachedModel(const std::string& source, uint32_t vertexStride, CachedModel& model){
+
+    std::string path = meshCachePath(source);
+    auto file = MappedFile::open(path);
+    if(!file || file->size < sizeof(MeshCacheHeader))
+        return false;
+
+    MeshCacheHeader header;
+    std::memcpy(&header, file->data, sizeof(header));
+    if(std::memcmp(header.magic, "SMSH", 4) != 0 || header.version != MESH_CACHE_VERSION ||
+       header.vertexStride != vertexStride || header.meshCount == 0)
+        return false;
+
+    if(!sourceUnchanged(source, path, offsetof(MeshCacheHeader, sourceSize), header.sourceSize, header.sourceMtime, header.sourceHash))
+        return false;
+
+    size_t tableEnd = sizeof(MeshCacheHeader) + (size_t)header.meshCount * sizeof(MeshCacheRecord);
+    if(file->size < tableEnd)
+        return false;
+
+    model.meshes.assign(header.meshCount, CachedMesh());
+    for(uint32_t m = 0; m < header.meshCount; m++){
+
+        MeshCacheRecord record;
+        std::memcpy(&record, file->data + sizeof(MeshCacheHeader) + m * sizeof(MeshCacheRecord), sizeof(record));
+
+        if((record.indexSize != 2 && record.indexSize != 4) ||
+           record.vertexOffset + (uint64_t)record.vertexCount * vertexStride > file->size ||
+           record.indexOffset + (uint64_t)record.indexCount * record.indexSize > file->size ||
+           record.textureOffset > file->size)
+            return false;
+
+        CachedMesh& mesh = model.meshes[m];
+        mesh.vertices = file->data + record.vertexOffset;
+        mesh.vertexCount = record.vertexCount;
+        mesh.indices = file->data + record.indexOffset;
+        mesh.indexCount = record.indexCount;
+        mesh.indexSize = record.indexSize;
+
+        //a few short strings per mesh, the only thing copied out
+        size_t cursor = (size_t)record.textureOffset;
+        for(uint32_t t = 0; t < record.textureCount * 2; t++){
+            uint32_t length;
+            if(cursor + sizeof(length) > file->size)
+                return false;
+            std::memcpy(&length, file->data + cursor, sizeof(length));
+            cursor += sizeof(length);
+            if(cursor + length > file->size)
+                return false;
+            std::string text((const char*)file->data + cursor, length);
+            cursor += length;
+
+            if(t % 2 == 0)
+                mesh.textures.push_back(CachedTexture{text, ""});
+            else
+                mesh.textures.back().path = text;
+        }
+    }
+
+    model.file = file;
+    return true;
+}
+
+//writes the entry for 'source'; through a temporary file so a reader never sees half of it
+inline void storeCachedModel(const std::string& source, uint32_t vertexStride, const std::vector<CachedMesh>& meshes){
+
+    if(meshes.empty())
+        return;
+
+    createCacheDirectory();
+
+    MeshCacheHeader header;
+    std::memcpy(header.magic, "SMSH", 4);
+    header.version = MESH_CACHE_VERSION;
+    header.vertexStride = vertexStride;
+    header.meshCount = (uint32_t)meshes.size();
+    header.sourceSize = 0;
+    header.sourceMtime = 0;
+    sourceStamp(source, header.sourceSize, header.sourceMtime);
+    header.sourceHash = hashFile(source);
+
+    //arrays start 16-byte aligned so the mapped pointers can be used as typed arrays directly
+    auto align = [](uint64_t offset){ return (offset + 15) & ~(uint64_t)15; };
+
+    std::vector<MeshCacheRecord> records(meshes.size());
+    uint64_t offset = sizeof(MeshCacheHeader) + meshes.size() * sizeof(MeshCacheRecord);
+    for(size_t m = 0; m < meshes.size(); m++){
+
+        MeshCacheRecord& record = records[m];
+        record.vertexCount = meshes[m].vertexCount;
+        record.indexCount = meshes[m].indexCount;
+        record.textureCount = (uint32_t)meshes[m].textures.size();
+        record.indexSize = meshes[m].indexSize;
+
+        record.vertexOffset = offset = align(offset);
+        offset += (uint64_t)record.vertexCount * vertexStride;
+        record.indexOffset = offset = align(offset);
+        offset += (uint64_t)record.indexCount * record.indexSize;
+        record.textureOffset = offset;
+        for(const auto &texture: meshes[m].textures)
+            offset += 2 * sizeof(uint32_t) + texture.type.size() + texture.path.size();
+    }
+
+    std::string path = meshCachePath(source);
+    std::string temporary = cacheTemporaryPath(path);
+
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if(!out){
+        std::cout << "MESH CACHE: CAN'T WRITE " << temporary << "\n";
+        return;
+    }
+
+    out.write((const char*)&header, sizeof(header));
+    out.write((const char*)records.data(), records.size() * sizeof(MeshCacheRecord));
+
+    auto pad = [&out](uint64_t to){
+        static const char zeros[16] = {};
+        uint64_t at = (uint64_t)out.tellp();
+        out.write(zeros, to - at);
+    };
+    auto writeString = [&out](const std::string& text){
+        uint32_t length = (uint32_t)text.size();
+        out.write((const char*)&length, sizeof(length));
+        out.write(text.data(), length);
+    };
+
+    for(size_t m = 0; m < meshes.size(); m++){
+        pad(records[m].vertexOffset);
+        out.write((const char*)meshes[m].vertices, (size_t)records[m].vertexCount * vertexStride);
+        pad(records[m].indexOffset);
+        out.write((const char*)meshes[m].indices, (size_t)records[m].indexCount * records[m].indexSize);
+        for(const auto &texture: meshes[m].textures){
+            writeString(texture.type);
+            writeString(texture.path);
+        }
+    }
+    out.close();
+
+    if(!out || std::rename(temporary.c_str(), path.c_str()) != 0){
+        std::cout << "MESH CACHE: CAN'T WRITE " << path << "\n";
+        std::remove(temporary.c_str());
+    }
+}
+
+#endif
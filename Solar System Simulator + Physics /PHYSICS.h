@@ -0,0 +1,755 @@
+#ifndef PHYSICS_H
+#define PHYSICS_H
+
+#include <vector>
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <random>
+
+#include <glm/glm.hpp>
+
+#include "SIMD_GRAVITY.h"
+#include "THREAD_POOL.h"
+#include "INTEGRATORS.h"
+
+//gravitational constant in simulation units (distance in world units, time in seconds, mass in arbitrary units)
+const float GRAVITY = 1.0f;
+//softening length, keeps close encounters from blowing up the integrator
+const float SOFTENING = 1.0f;
+
+//default physics step, the simulation always advances in multiples of this no matter the frame rate
+const float PHYSICS_DT = 1.0f / 120.0f;
+//most steps taken in one frame, past that the simulation slows down instead of spiralling
+const int MAX_SUBSTEPS = 32;
+
+//a body on rails leaves them inside this fraction of a perturber's sphere of influence,
+//and only goes back once it's clear of every sphere by SOI_REENTRY times its radius
+const float SOI_EXIT = 1.0f;
+const float SOI_REENTRY = 1.5f;
+
+//bodies per task: 1024 targets of x/y/z/ax/ay/az is 24KB, stays in L1/L2 while every source streams past
+const int GRAVITY_CHUNK = 1024;
+//the integrator does almost no work per body, bigger chunks keep task overhead negligible
+const int INTEGRATE_CHUNK = 8192;
+
+//Structure-of-arrays storage for every body in the scene.
+//Each component lives in its own contiguous array so physics and culling loops
+//only touch the data they need and the compiler can vectorize them.
+//Render objects refer to a body by its index in here.
+//Positions and velocities are double so orbits far from the origin don't lose their low bits every
+//step, accelerations are float: the force kernels work on float offsets from a nearby origin.
+struct BodyTable{
+
+    std::vector<double> x, y, z;
+    //positions before the last step, the renderer blends between these and x/y/z
+    std::vector<double> prevX, prevY, prevZ;
+    std::vector<double> vx, vy, vz;
+    std::vector<float> ax, ay, az;
+    std::vector<float> mass;
+    std::vector<float> radius;
+    //index of the body this one orbits, -1 for none
+    std::vector<int> parent;
+    //which surface texture the renderer uses for this body, -1 for none
+    std::vector<int> texture;
+
+    //how far render time is between the previous and the current state, 0..1
+    float blend = 1.0f;
+
+    int add(float m, float r, glm::dvec3 position, glm::dvec3 velocity, int parentIndex = -1, int textureIndex = -1){
+
+        x.push_back(position.x);
+        y.push_back(position.y);
+        z.push_back(position.z);
+        prevX.push_back(position.x);
+        prevY.push_back(position.y);
+        prevZ.push_back(position.z);
+        vx.push_back(velocity.x);
+        vy.push_back(velocity.y);
+        vz.push_back(velocity.z);
+        ax.push_back(0.0f);
+        ay.push_back(0.0f);
+        az.push_back(0.0f);
+        mass.push_back(m);
+        radius.push_back(r);
+        parent.push_back(parentIndex);
+        texture.push_back(textureIndex);
+
+        return (int)x.size() - 1;
+    }
+
+    void reserve(size_t count){
+        x.reserve(count); y.reserve(count); z.reserve(count);
+        prevX.reserve(count); prevY.reserve(count); prevZ.reserve(count);
+        vx.reserve(count); vy.reserve(count); vz.reserve(count);
+        ax.reserve(count); ay.reserve(count); az.reserve(count);
+        mass.reserve(count);
+        radius.reserve(count);
+        parent.reserve(count);
+        texture.reserve(count);
+    }
+
+    glm::dvec3 position(int i) const {
+        return glm::dvec3(x[i], y[i], z[i]);
+    }
+
+    //position interpolated between the last two physics states
+    glm::dvec3 renderPosition(int i) const {
+        return glm::dvec3(prevX[i] + (x[i] - prevX[i]) * blend,
+                          prevY[i] + (y[i] - prevY[i]) * blend,
+                          prevZ[i] + (z[i] - prevZ[i]) * blend);
+    }
+
+    glm::dvec3 velocity(int i) const {
+        return glm::dvec3(vx[i], vy[i], vz[i]);
+    }
+
+    size_t size() const {
+        return x.size();
+    }
+};
+
+//Strategy for evaluating gravity, NBodySystem owns one and scenes can swap it at any time.
+//'sources' are the indices of the bodies with mass, every body in 'bodies' gets its acceleration written.
+//Solvers work in float relative to an origin near the sources, the only place positions lose precision
+//is the force, which only needs a few digits anyway.
+class GravitySolver{
+
+    public:
+
+        virtual ~GravitySolver(){}
+
+        virtual void computeAccelerations(BodyTable& bodies, const std::vector<int>& sources, float G, float softening) = 0;
+
+        //same, but only the bodies listed in 'targets' get their acceleration written (block timesteps)
+        virtual void computeAccelerations(BodyTable& bodies, const std::vector<int>& sources, const std::vector<int>& targets, float G, float softening) = 0;
+};
+
+//Exact O(N*M) pairwise sum, best choice while there are only a handful of massive bodies.
+//Runs on the widest SIMD kernel the CPU supports.
+class DirectSolver: public GravitySolver{
+
+    public:
+
+        void computeAccelerations(BodyTable& bodies, const std::vector<int>& sources, float G, float softening) override{
+
+            const float eps2 = softening * softening;
+            const int sourceCount = gatherSources(bodies, sources, G);
+            const int count = (int)bodies.size();
+
+            tx.resize(count); ty.resize(count); tz.resize(count);
+
+            //self interaction drops out on its own since d == 0
+            workerPool().parallelFor(0, count, GRAVITY_CHUNK, [&](int begin, int end){
+                for(int i = begin; i < end; i++){
+                    tx[i] = (float)(bodies.x[i] - origin.x);
+                    ty[i] = (float)(bodies.y[i] - origin.y);
+                    tz[i] = (float)(bodies.z[i] - origin.z);
+                }
+
+                GravityBatch batch = {tx.data() + begin, ty.data() + begin, tz.data() + begin, end - begin,
+                                      sx.data(), sy.data(), sz.data(), sGM.data(), sourceCount,
+                                      eps2,
+                                      bodies.ax.data() + begin, bodies.ay.data() + begin, bodies.az.data() + begin};
+                gravityKernels().manyTargets(batch);
+            });
+        }
+
+        void computeAccelerations(BodyTable& bodies, const std::vector<int>& sources, const std::vector<int>& targets, float G, float softening) override{
+
+            const float eps2 = softening * softening;
+            const int sourceCount = gatherSources(bodies, sources, G);
+            const int count = (int)targets.size();
+
+            //targets are scattered through the table, pack them so the kernel still sees contiguous rows
+            tx.resize(count); ty.resize(count); tz.resize(count);
+            tax.resize(count); tay.resize(count); taz.resize(count);
+
+            workerPool().parallelFor(0, count, GRAVITY_CHUNK, [&](int begin, int end){
+                for(int t = begin; t < end; t++){
+                    tx[t] = (float)(bodies.x[targets[t]] - origin.x);
+                    ty[t] = (float)(bodies.y[targets[t]] - origin.y);
+                    tz[t] = (float)(bodies.z[targets[t]] - origin.z);
+                }
+
+                GravityBatch batch = {tx.data() + begin, ty.data() + begin, tz.data() + begin, end - begin,
+                                      sx.data(), sy.data(), sz.data(), sGM.data(), sourceCount,
+                                      eps2,
+                                      tax.data() + begin, tay.data() + begin, taz.data() + begin};
+                gravityKernels().manyTargets(batch);
+
+                for(int t = begin; t < end; t++){
+                    bodies.ax[targets[t]] = tax[t];
+                    bodies.ay[targets[t]] = tay[t];
+                    bodies.az[targets[t]] = taz[t];
+                }
+            });
+        }
+
+    private:
+
+        std::vector<float> sx, sy, sz, sGM;
+        std::vector<float> tx, ty, tz, tax, tay, taz;
+        //every position handed to the kernels is relative to this
+        glm::dvec3 origin;
+
+        //gather the massive bodies once so the inner loop streams through contiguous memory
+        int gatherSources(const BodyTable& bodies, const std::vector<int>& sources, float G){
+
+            const int sourceCount = (int)sources.size();
+            origin = sourceCount > 0 ? bodies.position(sources[0]) : glm::dvec3(0.0);
+
+            sx.resize(sourceCount);
+            sy.resize(sourceCount);
+            sz.resize(sourceCount);
+            sGM.resize(sourceCount);
+            for(int s = 0; s < sourceCount; s++){
+                sx[s] = (float)(bodies.x[sources[s]] - origin.x);
+                sy[s] = (float)(bodies.y[sources[s]] - origin.y);
+                sz[s] = (float)(bodies.z[sources[s]] - origin.z);
+                sGM[s] = G * bodies.mass[sources[s]];
+            }
+            return sourceCount;
+        }
+};
+
+//Holds every simulated body and advances them with pairwise Newtonian gravity.
+//Bodies with zero mass are test particles: they feel gravity but don't pull on anything,
+//so a scene of N bodies with M massive ones costs O(N*M) per step instead of O(N^2).
+//Test particles with a parent go one step further and ride on rails: their Kepler orbit around
+//the parent is evaluated in closed form once per frame, and they only get integrated while they
+//are inside another body's sphere of influence.
+class NBodySystem{
+
+    public:
+
+        BodyTable bodies;
+
+        float G;
+        float softening;
+
+        float fixedDt;
+        int maxSubsteps = MAX_SUBSTEPS;
+        IntegratorType integrator = IntegratorType::LEAPFROG;
+        //simulated seconds, always a whole number of steps
+        double time = 0.0;
+        //bodies whose acceleration was evaluated, the cost measure integrators are compared by
+        size_t forceEvaluations = 0;
+        BlockTimesteps blocks;
+        //put massless bodies with a parent on Kepler rails, set before adding bodies
+        bool keplerRails = true;
+
+        NBodySystem(float G = GRAVITY, float softening = SOFTENING, float fixedDt = PHYSICS_DT):G(G), softening(softening), fixedDt(fixedDt), solver(std::make_unique<DirectSolver>()){}
+
+        void setSolver(std::unique_ptr<GravitySolver> newSolver){
+            solver = std::move(newSolver);
+            accelerationsValid = false;
+        }
+
+        int addBody(float mass, float radius, glm::dvec3 position, glm::dvec3 velocity, int parent = -1){
+
+            int index = bodies.add(mass, radius, position, velocity, parent);
+            railSlot.push_back(-1);
+            if(mass > 0.0f)
+                sources.push_back(index);
+            else if(keplerRails && parent >= 0 && bodies.mass[parent] > 0.0f && !putOnRails(index)){
+                offRails.push_back(index);
+                offRailsCheck.push_back(time);
+            }
+
+            accelerationsValid = false;
+            return index;
+        }
+
+        //adds a body on a circular orbit around 'parent', 'offset' is the position relative to the parent
+        //and 'axis' the orbit normal (default orbits counter-clockwise around +Y, same as the old glm::rotate orbits)
+        int addOrbitingBody(float mass, float radius, int parent, glm::dvec3 offset, glm::dvec3 axis = glm::dvec3(0.0, 1.0, 0.0)){
+
+            double r = glm::length(offset);
+            double speed = std::sqrt((double)G * (bodies.mass[parent] + mass) / r);
+            glm::dvec3 direction = glm::normalize(glm::cross(axis, offset));
+
+            return addBody(mass, radius, bodies.position(parent) + offset, bodies.velocity(parent) + direction * speed, parent);
+        }
+
+        //shift every velocity so the total momentum is zero, otherwise the whole system drifts away from the origin
+        void removeNetMomentum(){
+
+            const int count = (int)bodies.size();
+            glm::dvec3 momentum(0.0);
+            double totalMass = 0.0;
+            for(int i = 0; i < count; i++){
+                momentum += bodies.velocity(i) * (double)bodies.mass[i];
+                totalMass += bodies.mass[i];
+            }
+            if(totalMass <= 0.0)
+                return;
+
+            glm::dvec3 drift = momentum / totalMass;
+            for(int i = 0; i < count; i++){
+                bodies.vx[i] -= drift.x;
+                bodies.vy[i] -= drift.y;
+                bodies.vz[i] -= drift.z;
+            }
+        }
+
+        //Fixed-timestep accumulator: banks the frame time and takes as many fixedDt steps as fit.
+        //The leftover fraction becomes the render blend, so drawing is smooth while the physics
+        //is the same on every machine. Returns the number of steps taken.
+        int advance(float frameTime){
+
+            accumulator += frameTime;
+
+            int steps = (int)(accumulator / fixedDt);
+            if(steps > maxSubsteps){
+                steps = maxSubsteps;
+                accumulator = steps * (double)fixedDt;
+            }
+
+            for(int s = 0; s < steps; s++){
+                step(fixedDt);
+                accumulator -= fixedDt;
+                time += fixedDt;
+            }
+
+            bodies.blend = (float)std::min(accumulator / fixedDt, 1.0);
+            updateRails();
+            return steps;
+        }
+
+        //time matching the interpolated positions, for anything animated alongside them
+        double renderTime() const {
+            return std::max(time - fixedDt + bodies.blend * fixedDt, 0.0);
+        }
+
+        //advance every body by dt with the selected integrator
+        void step(float dt){
+            switch(integrator){
+                case IntegratorType::YOSHIDA4: stepWith<Yoshida4>(dt); break;
+                case IntegratorType::WISDOM_HOLMAN: stepWith<WisdomHolman>(dt); break;
+                case IntegratorType::BLOCK_LEAPFROG: stepWith<BlockLeapfrog>(dt); break;
+                default: stepWith<Leapfrog>(dt); break;
+            }
+        }
+
+        template<class Integrator>
+        void stepWith(float dt){
+
+            if(!accelerationsValid)
+                computeAccelerations();
+
+            if(rails.size() == 0){
+                std::copy(bodies.x.begin(), bodies.x.end(), bodies.prevX.begin());
+                std::copy(bodies.y.begin(), bodies.y.end(), bodies.prevY.begin());
+                std::copy(bodies.z.begin(), bodies.z.end(), bodies.prevZ.begin());
+            }
+            else{
+                BodyTable& b = bodies;
+                forIntegrated([&b](int i){
+                    b.prevX[i] = b.x[i];
+                    b.prevY[i] = b.y[i];
+                    b.prevZ[i] = b.z[i];
+                });
+            }
+
+            Integrator::step(*this, dt);
+        }
+
+        //Places every body on rails at render time and hands the ones that wandered into a sphere of
+        //influence over to the integrator. Test particles the integrator holds go back on rails once
+        //they are clear again. Called by advance(), once per frame.
+        void updateRails(){
+
+            computeSpheresOfInfluence();
+
+            const double t = renderTime();
+            const int count = (int)rails.size();
+            railExit.assign(count, 0);
+
+            //the warm path a run at a time on the widest kernel, then whatever it couldn't do one by one
+            workerPool().parallelFor(0, count, KEPLER_CHUNK, [&](int begin, int end){
+                KeplerBlock block;
+                //orbits come in runs around the same parent, its render state is looked up once per run
+                int parent = -1;
+                glm::dvec3 parentPos, parentVel;
+                for(int first = begin; first < end; first += KeplerBlock::SIZE){
+
+                    int runLength = std::min(KeplerBlock::SIZE, end - first);
+                    keplerKernels().warm(rails, first, runLength, t, block);
+
+                    for(int j = 0; j < runLength; j++){
+
+                        int k = first + j;
+                        int i = railBody[k];
+                        int p = bodies.parent[i];
+                        double r[3] = {block.rx[j], block.ry[j], block.rz[j]};
+                        double v[3] = {block.vx[j], block.vy[j], block.vz[j]};
+                        if(block.cold[j] && !rails.evaluate(k, t, r, v)){
+                            railExit[k] = 1;
+                            continue;
+                        }
+
+                        if(p != parent){
+                            parent = p;
+                            parentPos = bodies.renderPosition(p);
+                            parentVel = bodies.velocity(p);
+                        }
+
+                        //already at render time, so the blend must not move it.
+                        //Nothing reads the velocity of a body on rails, leaveRails() sets it when it comes off
+                        bodies.x[i] = bodies.prevX[i] = parentPos.x + r[0];
+                        bodies.y[i] = bodies.prevY[i] = parentPos.y + r[1];
+                        bodies.z[i] = bodies.prevZ[i] = parentPos.z + r[2];
+
+                        //the nearest sphere can't be reached before this, no need to look again until then
+                        if(t < railCheck[k])
+                            continue;
+                        double clear = clearance(i, SOI_EXIT);
+                        double speed = glm::length(parentVel + glm::dvec3(v[0], v[1], v[2])) + fastestSource;
+                        railExit[k] = clear <= 0.0;
+                        railCheck[k] = speed > 0.0 ? t + 0.5 * clear / speed : t;
+                    }
+                }
+            });
+
+            //backwards, so swap-removal only moves slots that were already visited
+            handoff.clear();
+            for(int k = count - 1; k >= 0; k--){
+                if(railExit[k]){
+                    handoff.push_back(railBody[k]);
+                    leaveRails(k);
+                }
+            }
+            //they join the integrator mid-stream, it expects valid accelerations
+            computeAccelerationsFor(handoff);
+
+            //only the test particles that came off, each on its own deadline like the exit test.
+            //This frame's handoffs join the list afterwards, so they get integrated for at least a frame
+            for(int n = (int)offRails.size() - 1; n >= 0; n--){
+
+                if(t < offRailsCheck[n])
+                    continue;
+
+                int i = offRails[n];
+                double clear = clearance(i, SOI_REENTRY);
+                if(clear > 0.0 && putOnRails(i)){
+                    offRails[n] = offRails.back();
+                    offRails.pop_back();
+                    offRailsCheck[n] = offRailsCheck.back();
+                    offRailsCheck.pop_back();
+                    continue;
+                }
+
+                //it has to get -clear further out before it can be clear
+                double speed = glm::length(bodies.velocity(i)) + fastestSource;
+                offRailsCheck[n] = speed > 0.0 ? t + 0.5 * std::max(-clear, 0.0) / speed : t;
+            }
+
+            for(int i: handoff){
+                offRails.push_back(i);
+                offRailsCheck.push_back(t);
+            }
+        }
+
+        bool isOnRails(int index) const {
+            return railSlot[index] >= 0;
+        }
+
+        size_t railCount() const {
+            return rails.size();
+        }
+
+        //v += a * h
+        void kick(float h){
+
+            double* vx = bodies.vx.data();
+            double* vy = bodies.vy.data();
+            double* vz = bodies.vz.data();
+            const float* ax = bodies.ax.data();
+            const float* ay = bodies.ay.data();
+            const float* az = bodies.az.data();
+
+            forIntegrated([=](int i){
+                vx[i] += (double)ax[i] * h;
+                vy[i] += (double)ay[i] * h;
+                vz[i] += (double)az[i] * h;
+            });
+        }
+
+        //x += v * h
+        void drift(float h){
+
+            double* x = bodies.x.data();
+            double* y = bodies.y.data();
+            double* z = bodies.z.data();
+            const double* vx = bodies.vx.data();
+            const double* vy = bodies.vy.data();
+            const double* vz = bodies.vz.data();
+
+            forIntegrated([=](int i){
+                x[i] += vx[i] * h;
+                y[i] += vy[i] * h;
+                z[i] += vz[i] * h;
+            });
+        }
+
+        //runs body(i) for every body the integrator owns: all of them, or only the ones off rails
+        template<class Body>
+        void forIntegrated(const Body& body){
+
+            if(rails.size() == 0){
+                workerPool().parallelFor(0, (int)bodies.size(), INTEGRATE_CHUNK, [&](int begin, int end){
+                    for(int i = begin; i < end; i++)
+                        body(i);
+                });
+                return;
+            }
+
+            const std::vector<int>& list = integratedBodies();
+            workerPool().parallelFor(0, (int)list.size(), INTEGRATE_CHUNK, [&](int begin, int end){
+                for(int n = begin; n < end; n++)
+                    body(list[n]);
+            });
+        }
+
+        //scratch memory for integrators that need per-body temporaries, reused between steps
+        double* workspace(size_t count){
+            if(scratch.size() < count)
+                scratch.resize(count);
+            return scratch.data();
+        }
+
+        void computeAccelerations(){
+
+            if(rails.size() == 0){
+                solver->computeAccelerations(bodies, sources, G, softening);
+                forceEvaluations += bodies.size();
+            }
+            else{
+                //bodies on rails never read their acceleration
+                solver->computeAccelerations(bodies, sources, integratedBodies(), G, softening);
+                forceEvaluations += integrated.size();
+            }
+            accelerationsValid = true;
+        }
+
+        //only refresh the listed bodies, everyone else keeps the acceleration from their last evaluation
+        void computeAccelerationsFor(const std::vector<int>& targets){
+            if(targets.empty())
+                return;
+            solver->computeAccelerations(bodies, sources, targets, G, softening);
+            forceEvaluations += targets.size();
+        }
+
+        //indices of the bodies with mass
+        const std::vector<int>& sourceIndices() const {
+            return sources;
+        }
+
+        glm::dvec3 position(int index) const {
+            return bodies.position(index);
+        }
+
+        size_t size() const {
+            return bodies.size();
+        }
+
+    private:
+
+        std::vector<int> sources;
+        std::unique_ptr<GravitySolver> solver;
+        bool accelerationsValid = false;
+        double accumulator = 0.0;
+        std::vector<double> scratch;
+
+        KeplerOrbits rails;
+        //body riding each orbit, and each body's orbit slot (-1 when integrated)
+        std::vector<int> railBody;
+        //render time of each orbit's next sphere of influence test
+        std::vector<double> railCheck;
+        std::vector<int> railSlot;
+        //bodies not on rails, the force targets while any body is
+        std::vector<int> integrated;
+        bool integratedDirty = true;
+
+        std::vector<char> railExit;
+        std::vector<int> handoff;
+        //test particles that could ride on rails but are integrated, and the render time of each one's next re-entry test
+        std::vector<int> offRails;
+        std::vector<double> offRailsCheck;
+        //sphere of influence radius of every massive body that orbits something, 0 for the rest
+        std::vector<double> influence;
+        std::vector<int> perturbers;
+        //upper bound on how fast any sphere of influence moves
+        double fastestSource = 0.0;
+
+        const std::vector<int>& integratedBodies(){
+            if(integratedDirty){
+                integrated.clear();
+                for(int i = 0; i < (int)bodies.size(); i++)
+                    if(railSlot[i] < 0)
+                        integrated.push_back(i);
+                integratedDirty = false;
+            }
+            return integrated;
+        }
+
+        //false if there is no orbit to put it on (sitting on its parent)
+        bool putOnRails(int i){
+
+            int p = bodies.parent[i];
+            double r[3] = {bodies.x[i] - bodies.x[p], bodies.y[i] - bodies.y[p], bodies.z[i] - bodies.z[p]};
+            double v[3] = {bodies.vx[i] - bodies.vx[p], bodies.vy[i] - bodies.vy[p], bodies.vz[i] - bodies.vz[p]};
+            if(r[0] == 0.0 && r[1] == 0.0 && r[2] == 0.0)
+                return false;
+
+            railSlot[i] = rails.add(r, v, (double)G * (bodies.mass[p] + bodies.mass[i]), time);
+            railBody.push_back(i);
+            railCheck.push_back(time);
+            integratedDirty = true;
+            return true;
+        }
+
+        //state at physics time so the integrator picks up exactly where the conic was
+        void leaveRails(int k){
+
+            int i = railBody[k];
+            int p = bodies.parent[i];
+            double r[3], v[3];
+            if(rails.evaluate(k, time, r, v)){
+                bodies.x[i] = bodies.x[p] + r[0];
+                bodies.y[i] = bodies.y[p] + r[1];
+                bodies.z[i] = bodies.z[p] + r[2];
+                bodies.vx[i] = bodies.vx[p] + v[0];
+                bodies.vy[i] = bodies.vy[p] + v[1];
+                bodies.vz[i] = bodies.vz[p] + v[2];
+            }
+
+            int moved = rails.removeSwap(k);
+            railBody[k] = railBody[moved];
+            railBody.pop_back();
+            railCheck[k] = railCheck[moved];
+            railCheck.pop_back();
+            if(k != moved)
+                railSlot[railBody[k]] = k;
+            railSlot[i] = -1;
+            integratedDirty = true;
+        }
+
+        //Laplace radius a * (m / M)^(2/5), with the current distance standing in for a
+        void computeSpheresOfInfluence(){
+
+            influence.resize(bodies.size(), 0.0);
+            perturbers.clear();
+            fastestSource = 0.0;
+            for(int j: sources){
+                fastestSource = std::max(fastestSource, glm::length(bodies.velocity(j)));
+                int p = bodies.parent[j];
+                if(p < 0 || bodies.mass[p] <= 0.0f){
+                    influence[j] = 0.0;
+                    continue;
+                }
+                double distance = glm::length(bodies.position(j) - bodies.position(p));
+                influence[j] = distance * std::pow((double)bodies.mass[j] / bodies.mass[p], 0.4);
+                perturbers.push_back(j);
+            }
+        }
+
+        //How far test particle i is from being perturbed: from entering (margin times) the sphere of
+        //influence of anything but its parent and the parent's ancestors, or from leaving its parent's
+        //own sphere (shrunk by margin). Zero or less means it is perturbed.
+        double clearance(int i, double margin) const {
+
+            glm::dvec3 position = bodies.position(i);
+            int p = bodies.parent[i];
+
+            double clear = 1e300;
+            if(influence[p] > 0.0)
+                clear = influence[p] / margin - glm::length(position - bodies.position(p));
+
+            for(int j: perturbers){
+
+                bool ancestor = false;
+                for(int a = p; a >= 0; a = bodies.parent[a])
+                    if(a == j)
+                        ancestor = true;
+                if(ancestor)
+                    continue;
+
+                clear = std::min(clear, glm::length(position - bodies.position(j)) - influence[j] * margin);
+            }
+            return clear;
+        }
+};
+
+//Times a frame of the belt scene with test particles on rails against the same scene fully integrated
+//(direct sum, leapfrog), at 60 fps with the default step so each frame takes 2 steps.
+//Run with ./main --bench-rails
+inline void benchmarkKeplerRails(int particles = 20000, int moonlets = 200, int frames = 300, int repeats = 5){
+
+    const double frameTime = 1.0 / 60.0;
+    double seconds[2] = {0.0, 0.0};
+    size_t onRails = 0;
+
+    std::cout << "KEPLER RAILS BENCHMARK: " << particles << " belt particles, " << moonlets << " moonlets, 7 massive bodies, "
+              << frames << " frames, best of " << repeats << "\n";
+
+    for(int rails = 0; rails < 2; rails++){
+
+        std::mt19937 rng(1234);
+        std::uniform_real_distribution<double> unit(0.0, 1.0);
+
+        NBodySystem system;
+        system.keplerRails = rails == 1;
+
+        int sun = system.addBody(1.65e10f, 3000.0f, glm::dvec3(0.0), glm::dvec3(0.0));
+        const double planetDistance[6] = {6000.0, 9000.0, 15000.0, 22000.0, 45000.0, 60000.0};
+        const float planetMass[6] = {1e6f, 5e6f, 1e7f, 3e6f, 1e8f, 5e7f};
+        int planets[6];
+        for(int p = 0; p < 6; p++){
+            double angle = unit(rng) * 6.283185307179586;
+            planets[p] = system.addOrbitingBody(planetMass[p], 100.0f, sun, glm::dvec3(std::cos(angle), 0.0, std::sin(angle)) * planetDistance[p]);
+        }
+
+        //inside their planet's sphere of influence
+        for(int m = 0; m < moonlets; m++){
+            int planet = planets[m % 6];
+            double influence = planetDistance[m % 6] * std::pow((double)planetMass[m % 6] / 1.65e10, 0.4);
+            double distance = influence * (0.2 + 0.4 * unit(rng));
+            double angle = unit(rng) * 6.283185307179586;
+            system.addOrbitingBody(0.0f, 1.0f, planet, glm::dvec3(std::cos(angle), 0.0, std::sin(angle)) * distance);
+        }
+
+        //between the 4th and 5th planet, slightly inclined
+        for(int b = 0; b < particles; b++){
+            double distance = 28000.0 + 10000.0 * unit(rng);
+            double angle = unit(rng) * 6.283185307179586;
+            glm::dvec3 axis = glm::normalize(glm::dvec3(0.05 * (unit(rng) - 0.5), 1.0, 0.05 * (unit(rng) - 0.5)));
+            system.addOrbitingBody(0.0f, 1.0f, sun, glm::dvec3(std::cos(angle), 0.0, std::sin(angle)) * distance, axis);
+        }
+
+        //settle the caches and the warm starts
+        for(int f = 0; f < 60; f++)
+            system.advance((float)frameTime);
+
+        //best of a few runs, the way the gravity benchmark does it
+        seconds[rails] = 1e30;
+        for(int r = 0; r < repeats; r++){
+            auto start = std::chrono::steady_clock::now();
+            for(int f = 0; f < frames; f++)
+                system.advance((float)frameTime);
+            auto stop = std::chrono::steady_clock::now();
+            seconds[rails] = std::min(seconds[rails], std::chrono::duration<double>(stop - start).count());
+        }
+        if(rails)
+            onRails = system.railCount();
+    }
+
+    std::cout << "  DIRECT SUM (" << gravityKernels().name << "): " << seconds[0] / frames * 1000.0 << " ms/frame\n";
+    std::cout << "  RAILS (" << keplerKernels().name << "): " << seconds[1] / frames * 1000.0 << " ms/frame, "
+              << onRails << " bodies on rails, " << seconds[0] / seconds[1] << "x direct\n";
+}
+
+#endif
@@ -7,18 +7,43 @@
 #include <string>
 #include <fstream>
 #include <sstream>
+#include <unordered_map>
+#include <algorithm>
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
 
+//string lookups through the by-name setters since the last reset, only for profiling
+inline int& uniformLookups(){
+    static int count = 0;
+    return count;
+}
+
+//#defines put in front of both stages of every shader compiled after they are set, e.g. the depth mode (DEPTH.h)
+inline std::string& shaderDefines(){
+    static std::string defines;
+    return defines;
+}
+
+//binding point of the per-frame FrameData block, see FRAME_UNIFORMS.h
+const unsigned int FRAME_UNIFORMS_BINDING = 0;
+
+//a uniform location resolved once, typed by what may be written to it.
+//Callers keep these around so the per-frame path never touches a string
+template<class T>
+struct Uniform{
+    int location = -1;
+};
+
 class Shader{
 
     public:
         //program ID
         unsigned int ID;
         
-        Shader(const char* vertexPath, const char* fragmentPath){
+        //'fragmentPrelude', if given, is a file of shared GLSL pasted into the fragment shader right after its #version line
+        Shader(const char* vertexPath, const char* fragmentPath, const char* fragmentPrelude = nullptr){
 
             //1. Retrieve the vertex/frgament source code from filePath
             std::string vertexCode;
@@ -42,6 +67,21 @@ class Shader{
                 //convert stream intro string
                 vertexCode = vShaderStream.str();
                 fragmentCode = fshaderStream.str();
+
+                if(fragmentPrelude){
+                    std::ifstream preludeFile;
+                    preludeFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+                    preludeFile.open(fragmentPrelude);
+                    std::stringstream preludeStream;
+                    preludeStream << preludeFile.rdbuf();
+                    fragmentCode = afterVersion(fragmentCode, preludeStream.str());
+                }
+
+                //after the prelude so they end up in front of it
+                if(!shaderDefines().empty()){
+                    vertexCode = afterVersion(vertexCode, shaderDefines());
+                    fragmentCode = afterVersion(fragmentCode, shaderDefines());
+                }
             }
             catch(std::ifstream::failure e){
                 std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ"
@@ -90,24 +130,65 @@ class Shader{
  }
             glDeleteShader(vertex);
             glDeleteShader(fragment);
+
+            reflectUniforms();
+
+            //programs that declare the per-frame block all read it from the same binding point
+            unsigned int frameBlock = glGetUniformBlockIndex(ID, "FrameData");
+            if(frameBlock != GL_INVALID_INDEX)
+                glUniformBlockBinding(ID, frameBlock, FRAME_UNIFORMS_BINDING);
         }
         //use/activate the Shader
         void use(){
             glUseProgram(ID);
         }
-        //utility uniform functions
+        //location of an active uniform, -1 (ignored by glUniform*) if the program doesn't use it
+        int location(const std::string &name) const{
+            uniformLookups()++;
+            auto found = locations.find(name);
+            return found != locations.end() ? found->second : -1;
+        }
+
+        //resolve once, then set through the handle
+        template<class T>
+        Uniform<T> uniform(const std::string &name) const{
+            Uniform<T> handle;
+            handle.location = location(name);
+            return handle;
+        }
+
+        //typed uniform functions, no lookups
+        void set(Uniform<bool> u, bool value) const{
+            glUniform1i(u.location, (int)value);
+        }
+        void set(Uniform<int> u, int value) const{
+            glUniform1i(u.location, value);
+        }
+        void set(Uniform<float> u, float value) const{
+            glUniform1f(u.location, value);
+        }
+        void set(Uniform<glm::vec3> u, const glm::vec3 &value) const{
+            glUniform3fv(u.location, 1, glm::value_ptr(value));
+        }
+        void set(Uniform<glm::mat3> u, const glm::mat3 &value) const{
+            glUniformMatrix3fv(u.location, 1, GL_FALSE, glm::value_ptr(value));
+        }
+        void set(Uniform<glm::mat4> u, const glm::mat4 &value) const{
+            glUniformMatrix4fv(u.location, 1, GL_FALSE, glm::value_ptr(value));
+        }
+
+        //utility uniform functions, one hash lookup each; fine for setup, use handles per frame
         void setBool(const std::string &name, bool value) const{
-            glUniform1i(glGetUniformLocation(ID, name.c_str()),(int)value);
+            glUniform1i(location(name),(int)value);
         }
         void setInt(const std::string &name, int value) const{
-            glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
+            glUniform1i(location(name), value);
         }
         void setFloat(const std::string &name, float value) const{
-            glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
+            glUniform1f(location(name), value);
         }
         void setMat4(const std::string &name, glm::mat4 model){
-           unsigned int modelLoc = glGetUniformLocation(ID, name.c_str());
-           glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+           glUniformMatrix4fv(location(name), 1, GL_FALSE, glm::value_ptr(model));
         }
         /*
         void setVec3(const std::string &name, float x, float y, float z){
@@ -115,12 +196,46 @@ class Shader{
         }
         */
     void setVec3(const std::string &name, const glm::vec3 &value) const {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, glm::value_ptr(value));
+        glUniform3fv(location(name), 1, glm::value_ptr(value));
     }
- 
-};
 
+    private:
+
+        std::unordered_map<std::string, int> locations;
+
+        //GLSL wants #version first, anything shared goes on the line after it
+        static std::string afterVersion(const std::string& code, const std::string& text){
+            size_t line = code.find("#version");
+            size_t end = line == std::string::npos ? std::string::npos : code.find('\n', line);
+            if(end == std::string::npos)
+                return text + "\n" + code;
+            return code.substr(0, end + 1) + text + "\n" + code.substr(end + 1);
+        }
+
+        //every active uniform is asked for once, right after linking
+        void reflectUniforms(){
+
+            int count = 0, maxLength = 0;
+            glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+            glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+            std::string name(std::max(maxLength, 1), '\0');
+            for(int i = 0; i < count; i++){
+                int length = 0, size = 0;
+                GLenum type;
+                glGetActiveUniform(ID, i, maxLength, &length, &size, &type, &name[0]);
+
+                std::string uniformName = name.substr(0, length);
+                int loc = glGetUniformLocation(ID, uniformName.c_str());
+                locations[uniformName] = loc;
 
+                //arrays are reported as "name[0]", make the bare name work too
+                if(uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0)
+                    locations[uniformName.substr(0, uniformName.size() - 3)] = loc;
+            }
+        }
+ 
+};
 
 
 #endif
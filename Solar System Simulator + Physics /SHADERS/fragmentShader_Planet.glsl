@@ -1,34 +1,69 @@
 #version 330 core
 out vec4 FragColor;
 
-uniform sampler2D _texture;
-uniform vec3 lightPos;
-uniform vec3 viewPos;
-
-uniform float constant;
-uniform float linear;
-uniform float quadratic;
+uniform sampler2DArray _texture;
+layout (std140) uniform FrameData{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPos;
+    vec4 viewPos;
+};
 
+#ifdef IMPOSTOR
+//found by traceImpostor() instead of interpolated
+vec3 FragPos;
+vec3 Normal;
+vec2 TexCoords;
+#else
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
+#endif
+//constant, linear, quadratic
+flat in vec3 Attenuation;
+//-1 while the texture is still loading
+flat in float Layer;
+
+#if defined(LOG_DEPTH) && !defined(IMPOSTOR)
+//linear, the depth is its log
+in float ClipW;
+#endif
+
+vec4 surface(vec2 uv){
+#ifdef IMPOSTOR
+    return Layer < 0.0 ? vec4(0.5, 0.5, 0.5, 1.0) : textureGrad(_texture, vec3(uv, Layer), ImpostorDx, ImpostorDy);
+#else
+    return Layer < 0.0 ? vec4(0.5, 0.5, 0.5, 1.0) : texture(_texture, vec3(uv, Layer));
+#endif
+}
 
 void main()
 {
+#if defined(LOG_DEPTH) && !defined(IMPOSTOR)
+    gl_FragDepth = logDepth(ClipW);
+#endif
+#ifdef IMPOSTOR
+    traceImpostor(projection * view, viewPos.xyz, FragPos, Normal, TexCoords);
+#endif
+
+    float constant = Attenuation.x;
+    float linear = Attenuation.y;
+    float quadratic = Attenuation.z;
+
     vec3 norm = normalize(Normal);
-    vec3 lightDir = normalize(lightPos - FragPos);
-    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 lightDir = normalize(lightPos.xyz - FragPos);
+    vec3 viewDir = normalize(viewPos.xyz - FragPos);
     
-    float distance = length(lightPos - FragPos);
+    float distance = length(lightPos.xyz - FragPos);
     float attenuation = 1.0 / (constant + linear * distance + quadratic * distance * distance);
 
     // ==AMBIENT==
     float ambientStrength = 0.5f;
-    vec3 ambient = ambientStrength * vec3(texture(_texture, TexCoords));
+    vec3 ambient = ambientStrength * vec3(surface(TexCoords));
     
     // ==DIFFUSE==
     float diff = max(dot(norm, lightDir), 0.0);
-    vec3 diffuse = diff * vec3(texture(_texture, TexCoords));
+    vec3 diffuse = diff * vec3(surface(TexCoords));
     
     // ==SPECULAR== (FIXED)
     float specularStrength = 0.005f;
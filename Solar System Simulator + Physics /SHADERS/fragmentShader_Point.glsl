@@ -0,0 +1,21 @@
+#version 330 core
+
+out vec4 FragColor;
+//-1 while the texture is still loading
+flat in float Layer;
+
+uniform sampler2DArray _texture;
+
+#ifdef LOG_DEPTH
+//linear, the depth is its log
+in float ClipW;
+#endif
+
+void main(){
+#ifdef LOG_DEPTH
+	gl_FragDepth = logDepth(ClipW);
+#endif
+	//the last mip level is the average colour of the whole surface
+	vec4 surface = Layer < 0.0 ? vec4(0.5, 0.5, 0.5, 1.0) : textureLod(_texture, vec3(0.5, 0.5, Layer), 16.0);
+	FragColor = vec4(surface.rgb, 1.0);
+}
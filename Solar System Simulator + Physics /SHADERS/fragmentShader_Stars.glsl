@@ -1,10 +1,39 @@
 #version 330 core
 
 out vec4 FragColor;
+#ifdef IMPOSTOR
+//found by traceImpostor() instead of interpolated
+vec2 TexCoord;
+
+layout (std140) uniform FrameData{
+	mat4 view;
+	mat4 projection;
+	vec4 lightPos;
+	vec4 viewPos;
+};
+#else
 in vec2 TexCoord;
+#endif
+//-1 while the texture is still loading
+flat in float Layer;
+
+uniform sampler2DArray _texture;
 
-uniform sampler2D texture_diffuse;
+#if defined(LOG_DEPTH) && !defined(IMPOSTOR)
+//linear, the depth is its log
+in float ClipW;
+#endif
 
 void main(){
-	FragColor = texture(texture_diffuse, TexCoord) * 2.0f;
+#if defined(LOG_DEPTH) && !defined(IMPOSTOR)
+	gl_FragDepth = logDepth(ClipW);
+#endif
+#ifdef IMPOSTOR
+	vec3 position, normal;
+	traceImpostor(projection * view, viewPos.xyz, position, normal, TexCoord);
+	vec4 surface = Layer < 0.0 ? vec4(0.5, 0.5, 0.5, 1.0) : textureGrad(_texture, vec3(TexCoord, Layer), ImpostorDx, ImpostorDy);
+#else
+	vec4 surface = Layer < 0.0 ? vec4(0.5, 0.5, 0.5, 1.0) : texture(_texture, vec3(TexCoord, Layer));
+#endif
+	FragColor = surface * 2.0f;
 }
@@ -6,7 +6,17 @@ in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoord;
 
-uniform vec3 viewPos;
+layout (std140) uniform FrameData{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPos;
+    vec4 viewPos;
+};
+
+#ifdef LOG_DEPTH
+//linear, the depth is its log
+in float ClipW;
+#endif
 
 // Material (textures from model)
 struct Material {
@@ -48,8 +58,11 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
 
 void main()
 {
+#ifdef LOG_DEPTH
+    gl_FragDepth = logDepth(ClipW);
+#endif
     vec3 norm = normalize(Normal);
-    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 viewDir = normalize(viewPos.xyz - FragPos);
 
     vec3 result = CalcDirLight(dirLight, norm, viewDir);
     FragColor = vec4(result, 1.0);
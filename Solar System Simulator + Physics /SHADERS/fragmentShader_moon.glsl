@@ -3,28 +3,61 @@
 
 out vec4 FragColor;
 
-uniform sampler2D texture_diffuse;
+uniform sampler2DArray _texture;
 
-uniform vec3 lightPos;
-uniform vec3 viewPos;
+layout (std140) uniform FrameData{
+	mat4 view;
+	mat4 projection;
+	vec4 lightPos;
+	vec4 viewPos;
+};
 
 
+#ifdef IMPOSTOR
+//found by traceImpostor() instead of interpolated
+vec3 FragPos;
+vec3 Normal;
+vec2 TexCoord;
+#else
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoord;
+#endif
+//-1 while the texture is still loading
+flat in float Layer;
+
+#if defined(LOG_DEPTH) && !defined(IMPOSTOR)
+//linear, the depth is its log
+in float ClipW;
+#endif
+
+vec4 surface(vec2 uv){
+#ifdef IMPOSTOR
+	return Layer < 0.0 ? vec4(0.5, 0.5, 0.5, 1.0) : textureGrad(_texture, vec3(uv, Layer), ImpostorDx, ImpostorDy);
+#else
+	return Layer < 0.0 ? vec4(0.5, 0.5, 0.5, 1.0) : texture(_texture, vec3(uv, Layer));
+#endif
+}
 
 void main(){
+#if defined(LOG_DEPTH) && !defined(IMPOSTOR)
+	gl_FragDepth = logDepth(ClipW);
+#endif
+
+#ifdef IMPOSTOR
+	traceImpostor(projection * view, viewPos.xyz, FragPos, Normal, TexCoord);
+#endif
 
 	vec3 norm = normalize(Normal);
-	vec3 lightDir = normalize(lightPos - FragPos);
-	vec3 viewDir = normalize(viewPos - FragPos);
+	vec3 lightDir = normalize(lightPos.xyz - FragPos);
+	vec3 viewDir = normalize(viewPos.xyz - FragPos);
 	// ==AMBIENT==
 	float ambientStrength = 0.1f;
-	vec3 ambient = ambientStrength * vec3(texture(texture_diffuse, TexCoord));
+	vec3 ambient = ambientStrength * vec3(surface(TexCoord));
 	
 	// ==DIFFUSE==
 	float diff = max(dot(norm, lightDir), 0.0);
-	vec3 diffuse = diff * vec3(texture(texture_diffuse, TexCoord));
+	vec3 diffuse = diff * vec3(surface(TexCoord));
 	
 	// ==SPECULAR==
 	float specularStrength = 0.005f;
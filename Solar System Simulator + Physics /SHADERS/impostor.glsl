@@ -0,0 +1,64 @@
+//Pasted into a body's fragment shader to draw it as a ray-traced sphere on a camera-facing quad
+//(vertexShader_Impostor.glsl). The shader swaps its FragPos/Normal/TexCoord inputs for the values
+//traceImpostor() finds, everything after that is the same lighting as the triangle version.
+#define IMPOSTOR
+
+//render space (camera-relative) point on the quad
+in vec3 RayPoint;
+flat in vec3 Center;
+flat in float Radius;
+//render space to the body's own frame, the inverse of its rotation
+flat in mat3 Orientation;
+
+//texture coordinate derivatives without the jump at the seam, for textureGrad
+vec2 ImpostorDx;
+vec2 ImpostorDy;
+
+//hit point, normal and texture coordinate of the ray from 'eye' through this fragment, with depth written to match;
+//discards a miss. The coordinates are the sphere mesh's: u goes around from +x towards +z, v from the +y pole down
+void traceImpostor(mat4 viewProjection, vec3 eye, out vec3 position, out vec3 normal, out vec2 uv){
+
+	const float PI = 3.14159265;
+
+	vec3 direction = normalize(RayPoint - eye);
+	vec3 offset = eye - Center;
+	float b = dot(offset, direction);
+	float c = dot(offset, offset) - Radius * Radius;
+	float h = b * b - c;
+	//a miss is only discarded after the derivatives below: dFdx/dFdy are undefined once a fragment of the
+	//2x2 quad has left, so a miss runs on with h at 0, the point on the ray closest to the sphere
+	bool missed = h < 0.0;
+	h = max(h, 0.0);
+
+	//the near hit, or the far one from inside
+	float t = -b - sqrt(h);
+	if(t < 0.0)
+		t = -b + sqrt(h);
+
+	position = eye + direction * t;
+	normal = (position - Center) / Radius;
+
+	vec3 local = Orientation * normal;
+	float around = atan(local.z, local.x) / (2.0 * PI);
+	uv = vec2(fract(around), acos(clamp(local.y, -1.0, 1.0)) / PI);
+
+	//'around' jumps at the back, the same angle measured from -x jumps at the front; one of them is smooth here
+	float shifted = atan(-local.z, -local.x) / (2.0 * PI);
+	float dxAround = dFdx(around), dxShifted = dFdx(shifted);
+	float dyAround = dFdy(around), dyShifted = dFdy(shifted);
+	ImpostorDx = vec2(abs(dxAround) < abs(dxShifted) ? dxAround : dxShifted, dFdx(uv.y));
+	ImpostorDy = vec2(abs(dyAround) < abs(dyShifted) ? dyAround : dyShifted, dFdy(uv.y));
+
+	if(missed)
+		discard;
+
+	//the same depth the mesh would have had in the depth mode in use (DEPTH.h)
+	vec4 clip = viewProjection * vec4(position, 1.0);
+#if defined(LOG_DEPTH)
+	gl_FragDepth = logDepth(clip.w);
+#elif defined(REVERSED_Z)
+	gl_FragDepth = clip.z / clip.w;
+#else
+	gl_FragDepth = clip.z / clip.w * 0.5 + 0.5;
+#endif
+}
@@ -0,0 +1,48 @@
+#version 330 core
+
+//no vertex buffer: four vertices per instance, the corners of a triangle strip
+//per instance
+layout (location = 3) in mat4 model;
+layout (location = 7) in vec3 aAttenuation;
+layout (location = 8) in float aLayer;
+
+//per frame, shared by every program
+layout (std140) uniform FrameData{
+	mat4 view;
+	mat4 projection;
+	vec4 lightPos;
+	vec4 viewPos;
+};
+
+out vec3 RayPoint;
+flat out vec3 Center;
+flat out float Radius;
+flat out mat3 Orientation;
+flat out vec3 Attenuation;
+flat out float Layer;
+
+void main(){
+
+	Center = model[3].xyz;
+	//the bodies are unit spheres scaled the same on every axis
+	Radius = length(model[0].xyz);
+	Orientation = transpose(mat3(model) / Radius);
+	Attenuation = aAttenuation;
+	Layer = aLayer;
+
+	//facing the eye, big enough to hold the sphere's outline: the cone from the eye touching the sphere
+	//is r * d / sqrt(d^2 - r^2) wide where it passes the centre
+	vec3 toEye = viewPos.xyz - Center;
+	float distance = max(length(toEye), Radius * 1.001);
+	vec3 forward = toEye / distance;
+	vec3 cameraUp = vec3(view[0][1], view[1][1], view[2][1]);
+	vec3 right = cross(cameraUp, forward);
+	right = dot(right, right) < 1e-6 ? vec3(view[0][0], view[1][0], view[2][0]) : normalize(right);
+	vec3 up = cross(forward, right);
+	float halfSize = Radius * distance / sqrt(distance * distance - Radius * Radius);
+
+	vec2 corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+	RayPoint = Center + (right * corner.x + up * corner.y) * halfSize;
+
+	gl_Position = projection * view * vec4(RayPoint, 1.0);
+}
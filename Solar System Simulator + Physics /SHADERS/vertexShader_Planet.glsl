@@ -1,21 +1,47 @@
 #version 330 core
+//unit sphere, the position is also the normal
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoord;
 
-uniform mat4 projection;
-uniform mat4 view;
-uniform mat4 model;
+//per instance
+layout (location = 3) in mat4 model;
+layout (location = 7) in vec3 aAttenuation;
+layout (location = 8) in float aLayer;
+
+//per frame, shared by every program
+layout (std140) uniform FrameData{
+	mat4 view;
+	mat4 projection;
+	vec4 lightPos;
+	vec4 viewPos;
+};
 
 out vec3 Normal;
 out vec3 FragPos;
 out vec2 TexCoords;
+flat out vec3 Attenuation;
+flat out float Layer;
+
+#ifdef LOG_DEPTH
+//clip w, the distance along the view axis, for the fragment to take the log of
+out float ClipW;
+#endif
 
 void main(){
 	
 	FragPos = vec3(model * vec4(aPos, 1.0));
-	Normal = mat3(transpose(inverse(model))) * aNormal;
+#ifdef INVERSE_NORMALS
+	Normal = mat3(transpose(inverse(model))) * aPos;
+#else
+	//scaled the same on every axis, so mat3(model) is the normal matrix up to a factor the fragment normalizes away
+	Normal = mat3(model) * aPos;
+#endif
 	TexCoords = aTexCoord;
+	Attenuation = aAttenuation;
+	Layer = aLayer;
 
 	gl_Position = projection * view * model * vec4(aPos, 1.0);
+#ifdef LOG_DEPTH
+	ClipW = gl_Position.w;
+#endif
 }
@@ -0,0 +1,30 @@
+#version 330 core
+
+//per instance, only the position and the layer are used
+layout (location = 3) in mat4 model;
+layout (location = 8) in float aLayer;
+
+//per frame, shared by every program
+layout (std140) uniform FrameData{
+	mat4 view;
+	mat4 projection;
+	vec4 lightPos;
+	vec4 viewPos;
+};
+
+flat out float Layer;
+
+#ifdef LOG_DEPTH
+//clip w, the distance along the view axis, for the fragment to take the log of
+out float ClipW;
+#endif
+
+void main(){
+
+	Layer = aLayer;
+
+	gl_Position = projection * view * vec4(model[3].xyz, 1.0);
+#ifdef LOG_DEPTH
+	ClipW = gl_Position.w;
+#endif
+}
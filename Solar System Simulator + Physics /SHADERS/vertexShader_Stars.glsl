@@ -1,17 +1,35 @@
 #version 330 core
 layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec2 aTexCoord;
+layout (location = 2) in vec2 aTexCoord;
 
-uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+//per instance
+layout (location = 3) in mat4 model;
+layout (location = 8) in float aLayer;
+
+//per frame, shared by every program
+layout (std140) uniform FrameData{
+	mat4 view;
+	mat4 projection;
+	vec4 lightPos;
+	vec4 viewPos;
+};
 
 out vec2 TexCoord;
+flat out float Layer;
+
+#ifdef LOG_DEPTH
+//clip w, the distance along the view axis, for the fragment to take the log of
+out float ClipW;
+#endif
 
 void main(){
 
 	TexCoord = aTexCoord;
+	Layer = aLayer;
 
 	gl_Position = projection * view * model * vec4(aPos, 1.0f);
+#ifdef LOG_DEPTH
+	ClipW = gl_Position.w;
+#endif
 
 }
@@ -1,7 +1,7 @@
 #version 330 core
 
 layout (location = 0) in vec3 aPos;       // Vertex position
-layout (location = 1) in vec3 aNormal;    // Normal vector
+layout (location = 1) in vec2 aNormal;    // Normal vector, octahedral-encoded
 layout (location = 2) in vec2 aTexCoord;  // Texture coordinates
 
 out vec2 TexCoord;
@@ -9,16 +9,43 @@ out vec3 FragPos;
 out vec3 Normal;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+//set once per draw on the CPU; mat3(model) while the ship is only rotated and uniformly scaled
+uniform mat3 normalMatrix;
+
+//per frame, shared by every program
+layout (std140) uniform FrameData{
+    mat4 view;
+    mat4 projection;
+    vec4 lightPos;
+    vec4 viewPos;
+};
+
+#ifdef LOG_DEPTH
+//clip w, the distance along the view axis, for the fragment to take the log of
+out float ClipW;
+#endif
+
+vec3 octDecode(vec2 e){
+    vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+    float t = max(-n.z, 0.0);
+    n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+    return normalize(n);
+}
 
 void main() {
     gl_Position = projection * view * model * vec4(aPos, 1.0);
+#ifdef LOG_DEPTH
+    ClipW = gl_Position.w;
+#endif
 
     FragPos = vec3(model * vec4(aPos, 1.0));
     
+#ifdef INVERSE_NORMALS
     // Transform normal using transpose(inverse(model)) in case of non-uniform scaling
-    Normal = mat3(transpose(inverse(model))) * aNormal;
+    Normal = mat3(transpose(inverse(model))) * octDecode(aNormal);
+#else
+    Normal = normalMatrix * octDecode(aNormal);
+#endif
     
     TexCoord = aTexCoord;
 }
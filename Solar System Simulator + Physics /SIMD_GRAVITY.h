@@ -0,0 +1,365 @@
+#ifndef SIMD_GRAVITY_H
+#define SIMD_GRAVITY_H
+
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <chrono>
+#include <random>
+#include <algorithm>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GRAVITY_X86 1
+#endif
+
+//Pairwise gravity kernels in scalar, AVX2 and AVX-512 flavours, picked at runtime from CPUID.
+//The wide versions are compiled with per-function target attributes, so the rest of the
+//program doesn't need -mavx2 and still runs on machines without it.
+
+//targets [0, targetCount) get their accelerations overwritten with the sum over every source
+struct GravityBatch{
+
+    const float *tx, *ty, *tz;
+    int targetCount;
+
+    const float *sx, *sy, *sz, *sGM;
+    int sourceCount;
+
+    float eps2;
+
+    float *ax, *ay, *az;
+};
+
+enum class SimdLevel{
+    SCALAR,
+    AVX2,
+    AVX512
+};
+
+struct GravityKernels{
+
+    SimdLevel level;
+    const char* name;
+
+    //many targets against many sources, vectorized across targets (direct sum)
+    void (*manyTargets)(const GravityBatch& batch);
+    //one target against a list of sources, vectorized across sources (tree code interaction lists)
+    void (*oneTarget)(float tx, float ty, float tz, const float* sx, const float* sy, const float* sz, const float* sGM, int count, float eps2, float* acc);
+};
+
+inline void gravityRangeScalar(const GravityBatch& b, int begin, int end){
+
+    for(int i = begin; i < end; i++){
+
+        float accX = 0.0f, accY = 0.0f, accZ = 0.0f;
+        for(int s = 0; s < b.sourceCount; s++){
+
+            float dx = b.sx[s] - b.tx[i];
+            float dy = b.sy[s] - b.ty[i];
+            float dz = b.sz[s] - b.tz[i];
+            float invR = 1.0f / std::sqrt(dx * dx + dy * dy + dz * dz + b.eps2);
+            float f = b.sGM[s] * invR * invR * invR;
+            accX += dx * f;
+            accY += dy * f;
+            accZ += dz * f;
+        }
+        b.ax[i] = accX;
+        b.ay[i] = accY;
+        b.az[i] = accZ;
+    }
+}
+
+inline void gravityManyScalar(const GravityBatch& b){
+    gravityRangeScalar(b, 0, b.targetCount);
+}
+
+inline void gravityOneScalar(float tx, float ty, float tz, const float* sx, const float* sy, const float* sz, const float* sGM, int count, float eps2, float* acc){
+
+    float accX = 0.0f, accY = 0.0f, accZ = 0.0f;
+    for(int s = 0; s < count; s++){
+
+        float dx = sx[s] - tx;
+        float dy = sy[s] - ty;
+        float dz = sz[s] - tz;
+        float invR = 1.0f / std::sqrt(dx * dx + dy * dy + dz * dz + eps2);
+        float f = sGM[s] * invR * invR * invR;
+        accX += dx * f;
+        accY += dy * f;
+        accZ += dz * f;
+    }
+    acc[0] += accX;
+    acc[1] += accY;
+    acc[2] += accZ;
+}
+
+#ifdef GRAVITY_X86
+
+//rsqrt estimate refined with one Newton-Raphson step, close to full float precision
+__attribute__((target("avx2,fma")))
+inline __m256 rsqrtNR256(__m256 r2){
+    __m256 y = _mm256_rsqrt_ps(r2);
+    __m256 halfR2 = _mm256_mul_ps(r2, _mm256_set1_ps(0.5f));
+    __m256 t = _mm256_fnmadd_ps(_mm256_mul_ps(halfR2, y), y, _mm256_set1_ps(1.5f));
+    return _mm256_mul_ps(y, t);
+}
+
+__attribute__((target("avx2,fma")))
+inline void gravityManyAVX2(const GravityBatch& b){
+
+    const __m256 eps2 = _mm256_set1_ps(b.eps2);
+    const int wide = b.targetCount & ~7;
+
+    for(int i = 0; i < wide; i += 8){
+
+        __m256 tx = _mm256_loadu_ps(b.tx + i);
+        __m256 ty = _mm256_loadu_ps(b.ty + i);
+        __m256 tz = _mm256_loadu_ps(b.tz + i);
+        __m256 accX = _mm256_setzero_ps();
+        __m256 accY = _mm256_setzero_ps();
+        __m256 accZ = _mm256_setzero_ps();
+
+        for(int s = 0; s < b.sourceCount; s++){
+
+            __m256 dx = _mm256_sub_ps(_mm256_set1_ps(b.sx[s]), tx);
+            __m256 dy = _mm256_sub_ps(_mm256_set1_ps(b.sy[s]), ty);
+            __m256 dz = _mm256_sub_ps(_mm256_set1_ps(b.sz[s]), tz);
+            __m256 r2 = _mm256_fmadd_ps(dx, dx, eps2);
+            r2 = _mm256_fmadd_ps(dy, dy, r2);
+            r2 = _mm256_fmadd_ps(dz, dz, r2);
+            __m256 invR = rsqrtNR256(r2);
+            __m256 f = _mm256_mul_ps(_mm256_mul_ps(invR, invR), _mm256_mul_ps(invR, _mm256_set1_ps(b.sGM[s])));
+            accX = _mm256_fmadd_ps(dx, f, accX);
+            accY = _mm256_fmadd_ps(dy, f, accY);
+            accZ = _mm256_fmadd_ps(dz, f, accZ);
+        }
+
+        _mm256_storeu_ps(b.ax + i, accX);
+        _mm256_storeu_ps(b.ay + i, accY);
+        _mm256_storeu_ps(b.az + i, accZ);
+    }
+
+    gravityRangeScalar(b, wide, b.targetCount);
+}
+
+__attribute__((target("avx2,fma")))
+inline float horizontalSum256(__m256 v){
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 1));
+    return _mm_cvtss_f32(lo);
+}
+
+__attribute__((target("avx2,fma")))
+inline void gravityOneAVX2(float tx, float ty, float tz, const float* sx, const float* sy, const float* sz, const float* sGM, int count, float eps2, float* acc){
+
+    const __m256 vtx = _mm256_set1_ps(tx);
+    const __m256 vty = _mm256_set1_ps(ty);
+    const __m256 vtz = _mm256_set1_ps(tz);
+    const __m256 veps2 = _mm256_set1_ps(eps2);
+    __m256 accX = _mm256_setzero_ps();
+    __m256 accY = _mm256_setzero_ps();
+    __m256 accZ = _mm256_setzero_ps();
+
+    const int wide = count & ~7;
+    for(int s = 0; s < wide; s += 8){
+
+        __m256 dx = _mm256_sub_ps(_mm256_loadu_ps(sx + s), vtx);
+        __m256 dy = _mm256_sub_ps(_mm256_loadu_ps(sy + s), vty);
+        __m256 dz = _mm256_sub_ps(_mm256_loadu_ps(sz + s), vtz);
+        __m256 r2 = _mm256_fmadd_ps(dx, dx, veps2);
+        r2 = _mm256_fmadd_ps(dy, dy, r2);
+        r2 = _mm256_fmadd_ps(dz, dz, r2);
+        __m256 invR = rsqrtNR256(r2);
+        __m256 f = _mm256_mul_ps(_mm256_mul_ps(invR, invR), _mm256_mul_ps(invR, _mm256_loadu_ps(sGM + s)));
+        accX = _mm256_fmadd_ps(dx, f, accX);
+        accY = _mm256_fmadd_ps(dy, f, accY);
+        accZ = _mm256_fmadd_ps(dz, f, accZ);
+    }
+
+    acc[0] += horizontalSum256(accX);
+    acc[1] += horizontalSum256(accY);
+    acc[2] += horizontalSum256(accZ);
+
+    gravityOneScalar(tx, ty, tz, sx + wide, sy + wide, sz + wide, sGM + wide, count - wide, eps2, acc);
+}
+
+__attribute__((target("avx512f")))
+inline __m512 rsqrtNR512(__m512 r2){
+    __m512 y = _mm512_rsqrt14_ps(r2);
+    __m512 halfR2 = _mm512_mul_ps(r2, _mm512_set1_ps(0.5f));
+    __m512 t = _mm512_fnmadd_ps(_mm512_mul_ps(halfR2, y), y, _mm512_set1_ps(1.5f));
+    return _mm512_mul_ps(y, t);
+}
+
+__attribute__((target("avx512f")))
+inline void gravityManyAVX512(const GravityBatch& b){
+
+    const __m512 eps2 = _mm512_set1_ps(b.eps2);
+
+    for(int i = 0; i < b.targetCount; i += 16){
+
+        //the last partial block is handled with a lane mask instead of a scalar tail
+        int remaining = b.targetCount - i;
+        __mmask16 mask = remaining >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << remaining) - 1u);
+
+        __m512 tx = _mm512_maskz_loadu_ps(mask, b.tx + i);
+        __m512 ty = _mm512_maskz_loadu_ps(mask, b.ty + i);
+        __m512 tz = _mm512_maskz_loadu_ps(mask, b.tz + i);
+        __m512 accX = _mm512_setzero_ps();
+        __m512 accY = _mm512_setzero_ps();
+        __m512 accZ = _mm512_setzero_ps();
+
+        for(int s = 0; s < b.sourceCount; s++){
+
+            __m512 dx = _mm512_sub_ps(_mm512_set1_ps(b.sx[s]), tx);
+            __m512 dy = _mm512_sub_ps(_mm512_set1_ps(b.sy[s]), ty);
+            __m512 dz = _mm512_sub_ps(_mm512_set1_ps(b.sz[s]), tz);
+            __m512 r2 = _mm512_fmadd_ps(dx, dx, eps2);
+            r2 = _mm512_fmadd_ps(dy, dy, r2);
+            r2 = _mm512_fmadd_ps(dz, dz, r2);
+            __m512 invR = rsqrtNR512(r2);
+            __m512 f = _mm512_mul_ps(_mm512_mul_ps(invR, invR), _mm512_mul_ps(invR, _mm512_set1_ps(b.sGM[s])));
+            accX = _mm512_fmadd_ps(dx, f, accX);
+            accY = _mm512_fmadd_ps(dy, f, accY);
+            accZ = _mm512_fmadd_ps(dz, f, accZ);
+        }
+
+        _mm512_mask_storeu_ps(b.ax + i, mask, accX);
+        _mm512_mask_storeu_ps(b.ay + i, mask, accY);
+        _mm512_mask_storeu_ps(b.az + i, mask, accZ);
+    }
+}
+
+__attribute__((target("avx512f")))
+inline void gravityOneAVX512(float tx, float ty, float tz, const float* sx, const float* sy, const float* sz, const float* sGM, int count, float eps2, float* acc){
+
+    const __m512 vtx = _mm512_set1_ps(tx);
+    const __m512 vty = _mm512_set1_ps(ty);
+    const __m512 vtz = _mm512_set1_ps(tz);
+    const __m512 veps2 = _mm512_set1_ps(eps2);
+    __m512 accX = _mm512_setzero_ps();
+    __m512 accY = _mm512_setzero_ps();
+    __m512 accZ = _mm512_setzero_ps();
+
+    for(int s = 0; s < count; s += 16){
+
+        int remaining = count - s;
+        __mmask16 mask = remaining >= 16 ? (__mmask16)0xFFFF : (__mmask16)((1u << remaining) - 1u);
+
+        __m512 dx = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, sx + s), vtx);
+        __m512 dy = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, sy + s), vty);
+        __m512 dz = _mm512_sub_ps(_mm512_maskz_loadu_ps(mask, sz + s), vtz);
+        __m512 r2 = _mm512_fmadd_ps(dx, dx, veps2);
+        r2 = _mm512_fmadd_ps(dy, dy, r2);
+        r2 = _mm512_fmadd_ps(dz, dz, r2);
+        __m512 invR = rsqrtNR512(r2);
+        //masked lanes load GM = 0 so they add nothing
+        __m512 f = _mm512_mul_ps(_mm512_mul_ps(invR, invR), _mm512_mul_ps(invR, _mm512_maskz_loadu_ps(mask, sGM + s)));
+        accX = _mm512_fmadd_ps(dx, f, accX);
+        accY = _mm512_fmadd_ps(dy, f, accY);
+        accZ = _mm512_fmadd_ps(dz, f, accZ);
+    }
+
+    acc[0] += _mm512_reduce_add_ps(accX);
+    acc[1] += _mm512_reduce_add_ps(accY);
+    acc[2] += _mm512_reduce_add_ps(accZ);
+}
+
+#endif
+
+inline SimdLevel detectSimdLevel(){
+#ifdef GRAVITY_X86
+    //__builtin_cpu_supports reads CPUID and also checks the OS saves the wide registers (XGETBV)
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return SimdLevel::AVX512;
+    if(__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+        return SimdLevel::AVX2;
+#endif
+    return SimdLevel::SCALAR;
+}
+
+inline GravityKernels gravityKernelsFor(SimdLevel level){
+#ifdef GRAVITY_X86
+    if(level == SimdLevel::AVX512)
+        return {SimdLevel::AVX512, "AVX-512", gravityManyAVX512, gravityOneAVX512};
+    if(level == SimdLevel::AVX2)
+        return {SimdLevel::AVX2, "AVX2", gravityManyAVX2, gravityOneAVX2};
+#endif
+    return {SimdLevel::SCALAR, "SCALAR", gravityManyScalar, gravityOneScalar};
+}
+
+//best kernels for this machine, resolved once on first use
+inline const GravityKernels& gravityKernels(){
+    static const GravityKernels kernels = gravityKernelsFor(detectSimdLevel());
+    return kernels;
+}
+
+//Times every kernel this CPU supports on the same random cluster and prints the speed-up over scalar.
+//Run with ./main --bench-gravity
+inline void benchmarkGravityKernels(int targetCount = 16384, int sourceCount = 2048, int repeats = 5){
+
+    std::mt19937 rng(1234);
+    std::uniform_real_distribution<float> coord(-1000.0f, 1000.0f);
+    std::uniform_real_distribution<float> gm(1.0f, 100.0f);
+
+    std::vector<float> tx(targetCount), ty(targetCount), tz(targetCount);
+    std::vector<float> sx(sourceCount), sy(sourceCount), sz(sourceCount), sGM(sourceCount);
+    for(int i = 0; i < targetCount; i++){
+        tx[i] = coord(rng); ty[i] = coord(rng); tz[i] = coord(rng);
+    }
+    for(int s = 0; s < sourceCount; s++){
+        sx[s] = coord(rng); sy[s] = coord(rng); sz[s] = coord(rng); sGM[s] = gm(rng);
+    }
+
+    std::vector<float> refX(targetCount), refY(targetCount), refZ(targetCount);
+    std::vector<float> outX(targetCount), outY(targetCount), outZ(targetCount);
+
+    SimdLevel best = detectSimdLevel();
+    double scalarSeconds = 0.0;
+    double interactions = (double)targetCount * sourceCount;
+
+    std::cout << "GRAVITY KERNEL BENCHMARK: " << targetCount << " targets x " << sourceCount << " sources\n";
+
+    for(SimdLevel level: {SimdLevel::SCALAR, SimdLevel::AVX2, SimdLevel::AVX512}){
+
+        if((int)level > (int)best)
+            break;
+
+        GravityKernels k = gravityKernelsFor(level);
+        bool reference = level == SimdLevel::SCALAR;
+
+        GravityBatch batch = {tx.data(), ty.data(), tz.data(), targetCount,
+                              sx.data(), sy.data(), sz.data(), sGM.data(), sourceCount,
+                              1.0f,
+                              reference ? refX.data() : outX.data(),
+                              reference ? refY.data() : outY.data(),
+                              reference ? refZ.data() : outZ.data()};
+
+        double bestSeconds = 1e30;
+        for(int r = 0; r < repeats; r++){
+            auto start = std::chrono::steady_clock::now();
+            k.manyTargets(batch);
+            auto stop = std::chrono::steady_clock::now();
+            bestSeconds = std::min(bestSeconds, std::chrono::duration<double>(stop - start).count());
+        }
+        if(reference)
+            scalarSeconds = bestSeconds;
+
+        float maxError = 0.0f;
+        if(!reference){
+            for(int i = 0; i < targetCount; i++){
+                float ex = outX[i] - refX[i], ey = outY[i] - refY[i], ez = outZ[i] - refZ[i];
+                float len = std::sqrt(refX[i] * refX[i] + refY[i] * refY[i] + refZ[i] * refZ[i]);
+                maxError = std::max(maxError, std::sqrt(ex * ex + ey * ey + ez * ez) / len);
+            }
+        }
+
+        std::cout << "  " << k.name << ": " << bestSeconds * 1000.0 << " ms, "
+            << interactions / bestSeconds / 1e9 << " G interactions/s, "
+            << scalarSeconds / bestSeconds << "x scalar, max rel. error " << maxError << "\n";
+    }
+}
+
+#endif
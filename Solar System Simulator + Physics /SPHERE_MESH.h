@@ -0,0 +1,172 @@
+#ifndef SPHERE_MESH_H
+#define SPHERE_MESH_H
+
+#include <vector>
+#include <cmath>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+
+#include "glad/glad.h"
+
+#include "VERTEX_FORMAT.h"
+
+//Process-wide registry of UV sphere meshes, keyed by tessellation (segments around and from pole to pole).
+//Every body of the same tessellation draws the same VAO: built and uploaded on first use,
+//the CPU copy is thrown away right after the upload.
+//Only touched from the GL thread, like every other GL object.
+const int SPHERE_SEGMENTS = 64;
+
+//12 bytes instead of 32: the position in snorm16 (it's on the unit sphere) and the texCoord in unorm16.
+//There is no normal, on a unit sphere it's the position and the shaders take it from there
+struct SphereVertex{
+
+    int16_t position[3];
+    int16_t padding;
+    uint16_t texCoord[2];
+};
+
+struct SphereMesh{
+
+    unsigned int VAO = 0, VBO = 0, EBO = 0;
+    int indexCount = 0;
+    //GL_UNSIGNED_SHORT up to 255 segments
+    GLenum indexType = GL_UNSIGNED_INT;
+    int segments = 0;
+};
+
+//position and texCoord at locations 0 and 2, reading the currently bound GL_ARRAY_BUFFER;
+//also used by the instanced batches that wrap the shared buffers in VAOs of their own
+inline void setSphereAttributes(){
+
+    glVertexAttribPointer(0, 3, GL_SHORT, GL_TRUE, sizeof(SphereVertex), (void*)offsetof(SphereVertex, position));
+    glEnableVertexAttribArray(0);
+
+    glVertexAttribPointer(2, 2, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(SphereVertex), (void*)offsetof(SphereVertex, texCoord));
+    glEnableVertexAttribArray(2);
+}
+
+inline SphereMesh buildSphereMesh(int segments){
+
+    const int X_SEGMENTS = segments;
+    const int Y_SEGMENTS = segments;
+    const float PI = 3.14159265f;
+
+    std::vector<SphereVertex> vertices;
+    std::vector<unsigned int> indices;
+    vertices.reserve((size_t)(X_SEGMENTS + 1) * (Y_SEGMENTS + 1));
+    indices.reserve((size_t)X_SEGMENTS * Y_SEGMENTS * 6);
+
+    for(int y = 0; y <= Y_SEGMENTS; y++){
+        for(int x = 0; x <= X_SEGMENTS; x++){
+            float yStack = ((float)y / (float)Y_SEGMENTS);
+            float xSector = ((float)x / (float)X_SEGMENTS);
+
+            float phi = PI * yStack;
+            float theta = 2 * PI * xSector;
+
+            float xPos = std::cos(theta) * std::sin(phi);
+            float yPos = std::cos(phi);
+            float zPos = std::sin(theta) * std::sin(phi);
+
+            SphereVertex vertex;
+            vertex.position[0] = packSnorm16(xPos);
+            vertex.position[1] = packSnorm16(yPos);
+            vertex.position[2] = packSnorm16(zPos);
+            vertex.padding = 0;
+            vertex.texCoord[0] = packUnorm16(xSector);
+            vertex.texCoord[1] = packUnorm16(yStack);
+            vertices.push_back(vertex);
+        }
+    }
+
+    for(int y = 0; y < Y_SEGMENTS; y++){
+        for(int x = 0; x < X_SEGMENTS; x++){
+            unsigned int first = (y * (X_SEGMENTS + 1)) + x;
+            unsigned int second = first + X_SEGMENTS + 1;
+            indices.push_back(first);
+            indices.push_back(second);
+            indices.push_back(first + 1);
+
+            indices.push_back(second);
+            indices.push_back(second + 1);
+            indices.push_back(first + 1);
+        }
+    }
+
+    SphereMesh mesh;
+    mesh.segments = segments;
+    mesh.indexCount = (int)indices.size();
+    mesh.indexType = indexTypeFor(vertices.size());
+
+    glGenVertexArrays(1, &mesh.VAO);
+    glGenBuffers(1, &mesh.VBO);
+    glGenBuffers(1, &mesh.EBO);
+
+    glBindVertexArray(mesh.VAO);
+
+    glBindBuffer(GL_ARRAY_BUFFER, mesh.VBO);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(SphereVertex), vertices.data(), GL_STATIC_DRAW);
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.EBO);
+    if(mesh.indexType == GL_UNSIGNED_SHORT){
+        std::vector<unsigned short> shortIndices(indices.begin(), indices.end());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short), shortIndices.data(), GL_STATIC_DRAW);
+    }
+    else{
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+    }
+
+    setSphereAttributes();
+
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glBindVertexArray(0);
+
+    return mesh;
+}
+
+//Level-of-detail chain, coarsest first: 288 to 51200 triangles.
+//A body uses level i + 1 once its radius on screen passes SPHERE_LOD_PIXELS[i]; that keeps each segment
+//a few pixels long at every level. Below SPHERE_POINT_PIXELS it's a point sprite instead
+const int SPHERE_LODS = 5;
+const int SPHERE_LOD_SEGMENTS[SPHERE_LODS] = {12, 24, 48, 96, 160};
+const float SPHERE_LOD_PIXELS[SPHERE_LODS - 1] = {6.0f, 24.0f, 96.0f, 320.0f};
+const float SPHERE_POINT_PIXELS = 0.5f;
+//a body has to move this far past a threshold before it switches back, so it doesn't flicker on the edge
+const float SPHERE_LOD_HYSTERESIS = 0.15f;
+
+//level for a body 'pixels' in radius on screen that used 'current' last frame (-1 a point, anything lower: none yet)
+inline int selectSphereLod(float pixels, int current){
+
+    auto threshold = [](int level){
+        return level < 0 ? SPHERE_POINT_PIXELS : SPHERE_LOD_PIXELS[level];
+    };
+
+    if(current < -1){
+        int level = -1;
+        while(level < SPHERE_LODS - 1 && pixels >= threshold(level))
+            level++;
+        return level;
+    }
+
+    int level = current;
+    while(level < SPHERE_LODS - 1 && pixels >= threshold(level) * (1.0f + SPHERE_LOD_HYSTERESIS))
+        level++;
+    while(level > -1 && pixels < threshold(level - 1) * (1.0f - SPHERE_LOD_HYSTERESIS))
+        level--;
+    return level;
+}
+
+//the returned reference stays valid for the life of the process
+inline const SphereMesh& sphereMesh(int segments = SPHERE_SEGMENTS){
+
+    static std::unordered_map<int, SphereMesh> meshes;
+
+    auto found = meshes.find(segments);
+    if(found != meshes.end())
+        return found->second;
+
+    return meshes.emplace(segments, buildSphereMesh(segments)).first->second;
+}
+
+#endif
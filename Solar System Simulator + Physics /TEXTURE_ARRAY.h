@@ -0,0 +1,354 @@
+#ifndef TEXTURE_ARRAY_H
+#define TEXTURE_ARRAY_H
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+#include "glad/glad.h"
+#include "stb/stb_image.h"
+
+#include "THREAD_POOL.h"
+#include "ASSET_LOADER.h"
+#include "TEXTURE_CACHE.h"
+
+//Body surface textures packed into GL_TEXTURE_2D_ARRAYs, a body only carries (array, layer).
+//Sources are resampled to a size class: a power-of-two width between TEXTURE_MIN_WIDTH and TEXTURE_MAX_WIDTH
+//(the largest one not above the source) and half that height, the shape of the equirectangular maps they are.
+//The UV sphere maps the whole image whatever its aspect, so squeezing a 1200x630 map into 1024x512 changes nothing.
+//Each size class fills arrays ("pages") of up to GL_MAX_ARRAY_TEXTURE_LAYERS layers, so a scene with hundreds of
+//surfaces still only needs one array per class.
+const int TEXTURE_MIN_WIDTH = 256;
+const int TEXTURE_MAX_WIDTH = 2048;
+
+struct TextureLayer{
+
+    //GL_TEXTURE_2D_ARRAY name
+    unsigned int array = 0;
+    int layer = 0;
+    //unique per source file, in the order they were first asked for
+    int id = -1;
+};
+
+class TextureArrays{
+
+    public:
+
+        //internal format of arrays allocated from now on, GL_RGBA8 or BC1
+        GLenum format = GL_RGBA8;
+
+        //switches new arrays to BC1 (an eighth of the memory) if the driver has S3TC; it isn't core in GL 3.3
+        bool enableCompression(){
+
+            int count = 0;
+            glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+            for(int i = 0; i < count; i++){
+                const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+                if(name && std::strcmp(name, "GL_EXT_texture_compression_s3tc") == 0){
+                    format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+                    return true;
+                }
+            }
+            std::cout << "TEXTURE COMPRESSION: S3TC NOT SUPPORTED, KEEPING RGBA8\n";
+            return false;
+        }
+
+        //size class for a source this wide: the largest power of two not above it, within the limits
+        static int classWidth(int sourceWidth){
+            int width = TEXTURE_MIN_WIDTH;
+            while(width * 2 <= std::min(sourceWidth, TEXTURE_MAX_WIDTH))
+                width *= 2;
+            return width;
+        }
+
+        //the layer contents for 'path' as they get uploaded, from the disk cache when it has them,
+        //otherwise decoded, resampled, filtered (and compressed) here and written to the cache for next time.
+        //No GL calls, runs on workers and in the offline bake
+        static void prepareLayer(const std::string& path, int width, int height, GLenum format, DecodedImage& image){
+
+            if(loadCachedTexture(path, width, height, format, image))
+                return;
+
+            image = DecodedImage();
+            image.width = width;
+            image.height = height;
+            image.pixels.resize((size_t)width * height * 4);
+
+            //the global stbi flip flag isn't safe to touch from here, rows are flipped while resampling instead
+            int srcWidth, srcHeight, channels;
+            unsigned char* data = stbi_load(path.c_str(), &srcWidth, &srcHeight, &channels, 4);
+            if(data){
+                resampleImage(data, srcWidth, srcHeight, image.pixels.data(), width, height);
+                stbi_image_free(data);
+            }
+            else{
+                std::cout << "FAILED TO LOAD TEXTURE: " << path << "\n";
+                //grey rather than garbage for a missing file
+                std::fill(image.pixels.begin(), image.pixels.end(), 128);
+            }
+            buildMipChain(image);
+
+            if(format != GL_RGBA8)
+                image = compressBC1(image);
+
+            //a failed load isn't worth remembering
+            if(data)
+                storeCachedTexture(path, image);
+        }
+
+        //reserves a layer for the image at 'path', the same path always gets the same layer.
+        //Only the header is read here, pixels arrive after the next load()
+        TextureLayer acquire(const std::string& path){
+
+            auto found = loaded.find(path);
+            if(found != loaded.end())
+                return found->second;
+
+            int width = TEXTURE_MIN_WIDTH, height = 0, channels = 0;
+            if(!stbi_info(path.c_str(), &width, &height, &channels))
+                std::cout << "FAILED TO LOAD TEXTURE: " << path << "\n";
+
+            int page = openPage(classWidth(width));
+
+            TextureLayer texture;
+            texture.array = pages[page].ID;
+            texture.layer = pages[page].layers++;
+            texture.id = (int)loaded.size();
+
+            pending.push_back({path, page, texture.layer});
+            loaded[path] = texture;
+            return texture;
+        }
+
+        //gives every page acquired into since the last call its storage, then queues the sources on the asset loader:
+        //workers decode, resample and build the mip chain, assetLoader().pump() uploads each layer as it arrives.
+        //Pages that get storage here are sealed, later acquisitions open new ones
+        void load(){
+
+            if(pending.empty())
+                return;
+
+            for(auto &page: pages){
+                if(page.allocated || page.layers == 0)
+                    continue;
+
+                glBindTexture(GL_TEXTURE_2D_ARRAY, page.ID);
+
+                //the whole chain up front, layers are filled in level by level as they arrive
+                page.format = format;
+                int levels = 0;
+                for(int width = page.width, height = page.height; ; width = std::max(width / 2, 1), height = std::max(height / 2, 1)){
+                    if(page.format == GL_RGBA8)
+                        glTexImage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, width, height, page.layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+                    else
+                        glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, levels, page.format, width, height, page.layers, 0,
+                                               ((width + 3) / 4) * ((height + 3) / 4) * 8 * page.layers, nullptr);
+                    levels++;
+                    if(width == 1 && height == 1)
+                        break;
+                }
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+                glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+                page.allocated = true;
+            }
+            glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+            ready.resize(loaded.size(), 0);
+
+            for(auto &item: pending){
+
+                const Page& page = pages[item.page];
+                std::string path = item.path;
+                int width = page.width, height = page.height;
+                GLenum pageFormat = page.format;
+                unsigned int array = page.ID;
+                int layer = item.layer;
+                int id = loaded[path].id;
+
+                assetLoader().load(
+                    [path, width, height, pageFormat](DecodedImage& image){
+                        prepareLayer(path, width, height, pageFormat, image);
+                    },
+                    [this, array, layer, id](const DecodedImage& image, const unsigned char* pixels){
+
+                        glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+                        for(int level = 0; level < image.levels(); level++){
+                            if(image.compressed())
+                                glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, image.levelWidths[level], image.levelHeights[level], 1,
+                                                          image.format, (int)image.levelSizes[level], pixels + image.levelOffsets[level]);
+                            else
+                                glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, layer, image.levelWidths[level], image.levelHeights[level], 1,
+                                                GL_RGBA, GL_UNSIGNED_BYTE, pixels + image.levelOffsets[level]);
+                        }
+                        glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+                        ready[id] = 1;
+                    });
+            }
+
+            pending.clear();
+        }
+
+        //whether the texture with this id has been uploaded, until then bodies using it draw a placeholder
+        bool isReady(int id) const {
+            return id >= 0 && id < (int)ready.size() && ready[id];
+        }
+
+        int arrayCount() const {
+            return (int)pages.size();
+        }
+
+    private:
+
+        struct Page{
+
+            unsigned int ID = 0;
+            int width = 0, height = 0;
+            int layers = 0;
+            GLenum format = GL_RGBA8;
+            //storage is fixed once allocated, no more layers after that
+            bool allocated = false;
+        };
+
+        struct Pending{
+
+            std::string path;
+            int page;
+            int layer;
+        };
+
+        std::unordered_map<std::string, TextureLayer> loaded;
+        std::vector<Page> pages;
+        std::vector<Pending> pending;
+        //per texture id, set on the GL thread when its upload has run
+        std::vector<char> ready;
+        int maxLayers = 0;
+
+        //a page of this class that can still take a layer, a new one if there is none
+        int openPage(int width){
+
+            if(maxLayers == 0)
+                glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+
+            for(int p = 0; p < (int)pages.size(); p++)
+                if(pages[p].width == width && !pages[p].allocated && pages[p].layers < maxLayers)
+                    return p;
+
+            Page page;
+            glGenTextures(1, &page.ID);
+            page.width = width;
+            page.height = width / 2;
+            pages.push_back(page);
+            return (int)pages.size() - 1;
+        }
+
+        //area-average resampling: destination sample d covers source [lo, hi) with fractional weights at both ends.
+        //A footprint narrower than a source pixel is widened to one, which turns upsampling into linear interpolation
+        struct Tap{
+            int first;
+            std::vector<float> weights;
+        };
+
+        static std::vector<Tap> footprints(int srcSize, int dstSize){
+
+            std::vector<Tap> taps(dstSize);
+            float scale = (float)srcSize / (float)dstSize;
+            float half = std::max(scale, 1.0f) * 0.5f;
+
+            for(int d = 0; d < dstSize; d++){
+                float center = (d + 0.5f) * scale;
+                float lo = std::max(center - half, 0.0f);
+                float hi = std::min(center + half, (float)srcSize);
+
+                Tap& tap = taps[d];
+                tap.first = std::min((int)lo, srcSize - 1);
+                float total = 0.0f;
+                for(int s = tap.first; s < std::max((int)std::ceil(hi), tap.first + 1); s++){
+                    float weight = std::max(std::min(hi, s + 1.0f) - std::max(lo, (float)s), 0.0f);
+                    tap.weights.push_back(weight);
+                    total += weight;
+                }
+                for(auto &w: tap.weights)
+                    w = total > 0.0f ? w / total : 1.0f / tap.weights.size();
+            }
+            return taps;
+        }
+
+        static const int RESAMPLE_CHUNK = 32;
+
+        //RGBA8 -> RGBA8 at a new size and flipped vertically, horizontal pass then vertical; both walk memory row by row
+        static void resampleImage(const unsigned char* src, int srcWidth, int srcHeight,
+                                  unsigned char* dst, int dstWidth, int dstHeight){
+
+            std::vector<Tap> columns = footprints(srcWidth, dstWidth);
+            std::vector<Tap> rows = footprints(srcHeight, dstHeight);
+
+            //every source row squeezed to dstWidth, bottom row first (GL's texture origin is the bottom left)
+            std::vector<float> wide((size_t)dstWidth * srcHeight * 4);
+            workerPool().parallelFor(0, srcHeight, RESAMPLE_CHUNK, [&](int begin, int end){
+                for(int y = begin; y < end; y++){
+                    const unsigned char* in = src + (size_t)(srcHeight - 1 - y) * srcWidth * 4;
+                    float* out = wide.data() + (size_t)y * dstWidth * 4;
+                    for(int x = 0; x < dstWidth; x++){
+                        const Tap& tap = columns[x];
+                        float sum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+                        for(size_t t = 0; t < tap.weights.size(); t++){
+                            const unsigned char* pixel = in + (size_t)(tap.first + t) * 4;
+                            for(int c = 0; c < 4; c++)
+                                sum[c] += pixel[c] * tap.weights[t];
+                        }
+                        for(int c = 0; c < 4; c++)
+                            out[x * 4 + c] = sum[c];
+                    }
+                }
+            });
+
+            //each destination row is a weighted sum of whole rows of 'wide'
+            workerPool().parallelFor(0, dstHeight, RESAMPLE_CHUNK, [&](int begin, int end){
+                std::vector<float> sum((size_t)dstWidth * 4);
+                for(int y = begin; y < end; y++){
+                    const Tap& tap = rows[y];
+                    std::fill(sum.begin(), sum.end(), 0.0f);
+                    for(size_t t = 0; t < tap.weights.size(); t++){
+                        const float* in = wide.data() + (size_t)(tap.first + t) * dstWidth * 4;
+                        float weight = tap.weights[t];
+                        for(size_t i = 0; i < sum.size(); i++)
+                            sum[i] += in[i] * weight;
+                    }
+                    unsigned char* out = dst + (size_t)y * dstWidth * 4;
+                    for(size_t i = 0; i < sum.size(); i++)
+                        out[i] = (unsigned char)std::min(std::max(sum[i] + 0.5f, 0.0f), 255.0f);
+                }
+            });
+        }
+};
+
+//one set of arrays for every body in the process, GL thread only
+inline TextureArrays& bodyTextures(){
+    static TextureArrays arrays;
+    return arrays;
+}
+
+//offline bake: fills the disk cache for 'path' at the size its array would use, no GL needed
+inline void bakeTexture(const std::string& path, bool compressed){
+
+    int width = TEXTURE_MIN_WIDTH, height = 0, channels = 0;
+    if(!stbi_info(path.c_str(), &width, &height, &channels)){
+        std::cout << "FAILED TO LOAD TEXTURE: " << path << "\n";
+        return;
+    }
+
+    int classWidth = TextureArrays::classWidth(width);
+    DecodedImage image;
+    TextureArrays::prepareLayer(path, classWidth, classWidth / 2, compressed ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGBA8, image);
+    std::cout << "BAKED " << path << " -> " << textureCachePath(path, classWidth, classWidth / 2, image.format) << "\n";
+}
+
+#endif
@@ -0,0 +1,386 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#include <thread>
+#include <functional>
+
+#include <sys/stat.h>
+#if defined(_WIN32)
+#include <direct.h>
+#else
+//through stdio rather than open()/close(): <unistd.h> declares a pause() that clashes with main's flag
+#include <sys/mman.h>
+#endif
+
+#include "glad/glad.h"
+
+#include "ASSET_LOADER.h"
+
+//GPU-ready texture cache on disk.
+//Each entry is one resampled texture with its full mip chain exactly as it gets uploaded (RGBA8 or BC1),
+//so a warm start maps the file and hands the levels to the PBO without decoding, resampling or filtering anything.
+//An entry stays valid while its source keeps the size and mtime it was baked from; if those changed, the source is
+//hashed and the entry still counts when the contents are the same (a checkout or copy only touches the mtime);
+//the entry then takes the new stamp, so the hash is paid once and not on every start.
+//A missing source doesn't invalidate anything, a baked cache can ship on its own.
+const char* const TEXTURE_CACHE_DIR = "cache";
+const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+//from EXT_texture_compression_s3tc, not part of the GL 3.3 core headers
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+inline uint64_t fnv1a(const unsigned char* data, size_t size, uint64_t hash = 14695981039346656037ull){
+    for(size_t i = 0; i < size; i++){
+        hash ^= data[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+//read-only view of a whole file, mmap where there is one
+class MappedFile{
+
+    public:
+
+        const unsigned char* data = nullptr;
+        size_t size = 0;
+
+        static std::shared_ptr<MappedFile> open(const std::string& path){
+
+            std::shared_ptr<MappedFile> file(new MappedFile());
+#if defined(_WIN32)
+            std::ifstream in(path, std::ios::binary | std::ios::ate);
+            if(!in)
+                return nullptr;
+            file->copy.resize((size_t)in.tellg());
+            in.seekg(0);
+            in.read((char*)file->copy.data(), file->copy.size());
+            file->data = file->copy.data();
+            file->size = file->copy.size();
+#else
+            FILE* handle = std::fopen(path.c_str(), "rb");
+            if(!handle)
+                return nullptr;
+            struct stat info;
+            if(fstat(fileno(handle), &info) != 0 || info.st_size == 0){
+                std::fclose(handle);
+                return nullptr;
+            }
+            void* mapping = mmap(nullptr, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fileno(handle), 0);
+            std::fclose(handle);
+            if(mapping == MAP_FAILED)
+                return nullptr;
+            file->data = (const unsigned char*)mapping;
+            file->size = (size_t)info.st_size;
+#endif
+            return file;
+        }
+
+        ~MappedFile(){
+#if !defined(_WIN32)
+            if(data)
+                munmap((void*)data, size);
+#endif
+        }
+
+    private:
+
+        MappedFile(){}
+#if defined(_WIN32)
+        std::vector<unsigned char> copy;
+#endif
+};
+
+struct TextureCacheHeader{
+
+    char magic[4];
+    uint32_t version;
+    uint32_t format;
+    int32_t width, height, levels;
+    //sourceSize and sourceMtime stay next to each other, restampCacheEntry() writes them as one
+    uint64_t sourceSize;
+    int64_t sourceMtime;
+    uint64_t sourceHash;
+};
+
+struct TextureCacheLevel{
+
+    uint64_t offset, size;
+    int32_t width, height;
+};
+
+//size and mtime of a file, false if it isn't there
+inline bool sourceStamp(const std::string& path, uint64_t& size, int64_t& mtime){
+    struct stat info;
+    if(stat(path.c_str(), &info) != 0)
+        return false;
+    size = (uint64_t)info.st_size;
+    mtime = (int64_t)info.st_mtime;
+    return true;
+}
+
+inline uint64_t hashFile(const std::string& path){
+    auto file = MappedFile::open(path);
+    return file ? fnv1a(file->data, file->size) : 0;
+}
+
+//overwrites the size and mtime an entry was baked with, which sit together at 'stampOffset' in its header.
+//In place: a write cut short just leaves a stamp that doesn't match and the next start hashes again
+inline void restampCacheEntry(const std::string& entry, size_t stampOffset, uint64_t size, int64_t mtime){
+
+    FILE* handle = std::fopen(entry.c_str(), "r+b");
+    if(!handle)
+        return;
+    unsigned char stamp[sizeof(size) + sizeof(mtime)];
+    std::memcpy(stamp, &size, sizeof(size));
+    std::memcpy(stamp + sizeof(size), &mtime, sizeof(mtime));
+    if(std::fseek(handle, (long)stampOffset, SEEK_SET) != 0 || std::fwrite(stamp, sizeof(stamp), 1, handle) != 1)
+        std::cout << "CACHE: CAN'T UPDATE " << entry << "\n";
+    std::fclose(handle);
+}
+
+//whether 'entry', baked from 'source' with this stamp and hash, still describes it.
+//Only hashes when the stamp moved, and moves the entry's stamp along when the contents turn out the same;
+//a missing source counts as unchanged
+inline bool sourceUnchanged(const std::string& source, const std::string& entry, size_t stampOffset,
+                            uint64_t bakedSize, int64_t bakedMtime, uint64_t bakedHash){
+    uint64_t size;
+    int64_t mtime;
+    if(!sourceStamp(source, size, mtime) || (size == bakedSize && mtime == bakedMtime))
+        return true;
+    if(hashFile(source) != bakedHash)
+        return false;
+    restampCacheEntry(entry, stampOffset, size, mtime);
+    return true;
+}
+
+inline void createCacheDirectory(){
+#if defined(_WIN32)
+    _mkdir(TEXTURE_CACHE_DIR);
+#else
+    mkdir(TEXTURE_CACHE_DIR, 0755);
+#endif
+}
+
+//where a writer puts an entry before renaming it into place, unique per thread
+inline std::string cacheTemporaryPath(const std::string& path){
+    return path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+}
+
+//one entry per source, size and format
+inline std::string textureCachePath(const std::string& source, int width, int height, GLenum format){
+    char name[96];
+    std::snprintf(name, sizeof(name), "%016llx_%dx%d%s.tex", (unsigned long long)fnv1a((const unsigned char*)source.data(), source.size()),
+                  width, height, format == GL_RGBA8 ? "" : "_bc1");
+    return std::string(TEXTURE_CACHE_DIR) + "/" + name;
+}
+
+//maps a valid entry straight into 'image' (no copy), false on a miss
+inline bool loadCachedTexture(const std::string& source, int width, int height, GLenum format, DecodedImage& image){
+
+    std::string path = textureCachePath(source, width, height, format);
+    auto file = MappedFile::open(path);
+    if(!file || file->size < sizeof(TextureCacheHeader))
+        return false;
+
+    TextureCacheHeader header;
+    std::memcpy(&header, file->data, sizeof(header));
+    if(std::memcmp(header.magic, "STEX", 4) != 0 || header.version != TEXTURE_CACHE_VERSION || header.format != format ||
+       header.width != width || header.height != height || header.levels <= 0)
+        return false;
+
+    if(!sourceUnchanged(source, path, offsetof(TextureCacheHeader, sourceSize), header.sourceSize, header.sourceMtime, header.sourceHash))
+        return false;
+
+    size_t tableEnd = sizeof(TextureCacheHeader) + (size_t)header.levels * sizeof(TextureCacheLevel);
+    if(file->size < tableEnd)
+        return false;
+
+    image = DecodedImage();
+    image.width = width;
+    image.height = height;
+    image.format = format;
+
+    size_t dataSize = file->size - tableEnd;
+    for(int level = 0; level < header.levels; level++){
+        TextureCacheLevel entry;
+        std::memcpy(&entry, file->data + sizeof(TextureCacheHeader) + level * sizeof(TextureCacheLevel), sizeof(entry));
+        if(entry.offset + entry.size > dataSize)
+            return false;
+        image.levelOffsets.push_back((size_t)entry.offset);
+        image.levelSizes.push_back((size_t)entry.size);
+        image.levelWidths.push_back(entry.width);
+        image.levelHeights.push_back(entry.height);
+    }
+
+    image.borrowed = file->data + tableEnd;
+    image.borrowedSize = dataSize;
+    image.backing = file;
+    return true;
+}
+
+//writes 'image' as the entry for 'source'; through a temporary file so a reader never sees half of it
+inline void storeCachedTexture(const std::string& source, const DecodedImage& image){
+
+    createCacheDirectory();
+
+    TextureCacheHeader header;
+    std::memcpy(header.magic, "STEX", 4);
+    header.version = TEXTURE_CACHE_VERSION;
+    header.format = image.format;
+    header.width = image.width;
+    header.height = image.height;
+    header.levels = image.levels();
+    header.sourceSize = 0;
+    header.sourceMtime = 0;
+    sourceStamp(source, header.sourceSize, header.sourceMtime);
+    header.sourceHash = hashFile(source);
+
+    std::string path = textureCachePath(source, image.width, image.height, image.format);
+    std::string temporary = cacheTemporaryPath(path);
+
+    std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+    if(!out){
+        std::cout << "TEXTURE CACHE: CAN'T WRITE " << temporary << "\n";
+        return;
+    }
+    out.write((const char*)&header, sizeof(header));
+    for(int level = 0; level < image.levels(); level++){
+        TextureCacheLevel entry;
+        entry.offset = image.levelOffsets[level];
+        entry.size = image.levelSizes[level];
+        entry.width = image.levelWidths[level];
+        entry.height = image.levelHeights[level];
+        out.write((const char*)&entry, sizeof(entry));
+    }
+    out.write((const char*)image.data(), image.size());
+    out.close();
+
+    if(!out || std::rename(temporary.c_str(), path.c_str()) != 0){
+        std::cout << "TEXTURE CACHE: CAN'T WRITE " << path << "\n";
+        std::remove(temporary.c_str());
+    }
+}
+
+//BC1 (DXT1) block: two RGB565 endpoints and a 2-bit index per pixel into the four colors between them.
+//Endpoints are the corners of the block's color bounding box pulled in by 1/16 of its size, which ignores
+//outliers cheaply (van Waveren, "Real-Time DXT Compression")
+inline void encodeBC1Block(const unsigned char block[16][4], unsigned char out[8]){
+
+    int lo[3] = {255, 255, 255}, hi[3] = {0, 0, 0};
+    for(int p = 0; p < 16; p++)
+        for(int c = 0; c < 3; c++){
+            lo[c] = std::min(lo[c], (int)block[p][c]);
+            hi[c] = std::max(hi[c], (int)block[p][c]);
+        }
+    for(int c = 0; c < 3; c++){
+        int inset = (hi[c] - lo[c]) >> 4;
+        lo[c] = std::min(lo[c] + inset, 255);
+        hi[c] = std::max(hi[c] - inset, 0);
+    }
+
+    auto pack = [](const int rgb[3]) -> unsigned {
+        return (unsigned)((rgb[0] >> 3) << 11 | (rgb[1] >> 2) << 5 | (rgb[2] >> 3));
+    };
+    auto unpack = [](unsigned v, int rgb[3]){
+        rgb[0] = (int)((v >> 11) & 31) * 255 / 31;
+        rgb[1] = (int)((v >> 5) & 63) * 255 / 63;
+        rgb[2] = (int)(v & 31) * 255 / 31;
+    };
+
+    unsigned c0 = pack(hi), c1 = pack(lo);
+    //c0 > c1 selects the opaque four-color mode; equal endpoints just use index 0
+    if(c0 < c1)
+        std::swap(c0, c1);
+
+    int palette[4][3];
+    unpack(c0, palette[0]);
+    unpack(c1, palette[1]);
+    for(int c = 0; c < 3; c++){
+        palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+        palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+    }
+
+    unsigned indices = 0;
+    for(int p = 0; p < 16; p++){
+        int best = 0, bestDistance = 1 << 30;
+        for(int i = 0; i < (c0 == c1 ? 1 : 4); i++){
+            int distance = 0;
+            for(int c = 0; c < 3; c++){
+                int d = (int)block[p][c] - palette[i][c];
+                distance += d * d;
+            }
+            if(distance < bestDistance){
+                bestDistance = distance;
+                best = i;
+            }
+        }
+        indices |= (unsigned)best << (2 * p);
+    }
+
+    out[0] = (unsigned char)(c0 & 0xff);
+    out[1] = (unsigned char)(c0 >> 8);
+    out[2] = (unsigned char)(c1 & 0xff);
+    out[3] = (unsigned char)(c1 >> 8);
+    for(int i = 0; i < 4; i++)
+        out[4 + i] = (unsigned char)(indices >> (8 * i));
+}
+
+//block rows per task when compressing
+const int BC1_ROW_CHUNK = 16;
+
+//RGBA8 mip chain -> BC1 mip chain; levels smaller than a block are padded by repeating their edge
+inline DecodedImage compressBC1(const DecodedImage& rgba){
+
+    DecodedImage result;
+    result.width = rgba.width;
+    result.height = rgba.height;
+    result.format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+
+    size_t total = 0;
+    for(int level = 0; level < rgba.levels(); level++){
+        int blocksX = (rgba.levelWidths[level] + 3) / 4, blocksY = (rgba.levelHeights[level] + 3) / 4;
+        result.levelOffsets.push_back(total);
+        result.levelSizes.push_back((size_t)blocksX * blocksY * 8);
+        result.levelWidths.push_back(rgba.levelWidths[level]);
+        result.levelHeights.push_back(rgba.levelHeights[level]);
+        total += result.levelSizes.back();
+    }
+    result.pixels.resize(total);
+
+    for(int level = 0; level < rgba.levels(); level++){
+
+        const unsigned char* src = rgba.data() + rgba.levelOffsets[level];
+        unsigned char* dst = result.pixels.data() + result.levelOffsets[level];
+        int width = rgba.levelWidths[level], height = rgba.levelHeights[level];
+        int blocksX = (width + 3) / 4, blocksY = (height + 3) / 4;
+
+        workerPool().parallelFor(0, blocksY, BC1_ROW_CHUNK, [&](int begin, int end){
+            unsigned char block[16][4];
+            for(int by = begin; by < end; by++)
+                for(int bx = 0; bx < blocksX; bx++){
+                    for(int p = 0; p < 16; p++){
+                        int x = std::min(bx * 4 + (p & 3), width - 1);
+                        int y = std::min(by * 4 + (p >> 2), height - 1);
+                        std::memcpy(block[p], src + ((size_t)y * width + x) * 4, 4);
+                    }
+                    encodeBC1Block(block, dst + ((size_t)by * blocksX + bx) * 8);
+                }
+        });
+    }
+    return result;
+}
+
+#endif
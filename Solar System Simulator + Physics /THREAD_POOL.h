@@ -0,0 +1,249 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <algorithm>
+
+//Work-stealing task scheduler shared by physics, culling and asset loading.
+//Every worker owns a deque: it pushes and pops its own work at the back (LIFO, hot in cache)
+//and, when it runs dry, steals from the front of the other workers' deques (FIFO, the oldest and
+//usually largest pieces). Threads that aren't workers (the GLFW thread) help out while they wait.
+class ThreadPool{
+
+    public:
+
+        ThreadPool(unsigned threadCount = defaultThreadCount()){
+
+            for(unsigned i = 0; i < threadCount; i++)
+                queues.push_back(std::make_unique<WorkQueue>());
+
+            for(unsigned i = 0; i < threadCount; i++)
+                threads.emplace_back([this, i]{ workerLoop((int)i); });
+        }
+
+        ~ThreadPool(){
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for(auto &t: threads)
+                t.join();
+            if(backgroundThread.joinable())
+                backgroundThread.join();
+        }
+
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        //main thread does work too, so one less than the core count
+        static unsigned defaultThreadCount(){
+            unsigned cores = std::thread::hardware_concurrency();
+            return cores > 1 ? cores - 1 : 0;
+        }
+
+        unsigned size() const {
+            return (unsigned)threads.size();
+        }
+
+        //fire-and-forget task; from a worker it lands on that worker's own deque
+        void submit(std::function<void()> task){
+
+            if(threads.empty()){
+                task();
+                return;
+            }
+
+            int self = currentWorker();
+            int target = self >= 0 ? self : (int)(nextQueue++ % queues.size());
+            {
+                std::lock_guard<std::mutex> lock(queues[target]->mutex);
+                queues[target]->tasks.push_back(std::move(task));
+            }
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                pending++;
+            }
+            wake.notify_one();
+        }
+
+        //long, latency-insensitive task (asset decoding). Only idle workers pick these up: a thread waiting
+        //in parallelFor never does, so a frame or a physics step can't get stuck behind one.
+        //Never runs on the caller: a pool without workers (one core) starts a thread of its own for these
+        void submitBackground(std::function<void()> task){
+
+            {
+                std::lock_guard<std::mutex> lock(backgroundMutex);
+                background.push_back(std::move(task));
+                if(threads.empty() && !backgroundThread.joinable())
+                    backgroundThread = std::thread([this]{ backgroundLoop(); });
+            }
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                pending++;
+            }
+            wake.notify_one();
+        }
+
+        //runs body(chunkBegin, chunkEnd) over [begin, end) split into chunks of 'grain' items and
+        //returns once every chunk is done. The calling thread executes tasks while it waits, so
+        //nesting parallelFor inside a task can't deadlock.
+        template<class Body>
+        void parallelFor(int begin, int end, int grain, const Body& body){
+
+            int count = end - begin;
+            if(count <= 0)
+                return;
+
+            grain = std::max(grain, 1);
+            int chunks = (count + grain - 1) / grain;
+            if(chunks == 1 || threads.empty()){
+                body(begin, end);
+                return;
+            }
+
+            std::atomic<int> remaining(chunks - 1);
+            for(int c = 1; c < chunks; c++){
+                int chunkBegin = begin + c * grain;
+                int chunkEnd = std::min(chunkBegin + grain, end);
+                submit([&body, &remaining, chunkBegin, chunkEnd]{
+                    body(chunkBegin, chunkEnd);
+                    //last touch of the caller's stack, the caller may return right after this
+                    remaining.fetch_sub(1, std::memory_order_release);
+                });
+            }
+
+            //first chunk on this thread, then help with whatever is queued until ours are finished
+            body(begin, std::min(begin + grain, end));
+            while(remaining.load(std::memory_order_acquire) > 0){
+                if(!runOne(currentWorker(), false))
+                    std::this_thread::yield();
+            }
+        }
+
+    private:
+
+        struct WorkQueue{
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+        };
+
+        std::vector<std::unique_ptr<WorkQueue>> queues;
+        std::vector<std::thread> threads;
+
+        std::mutex backgroundMutex;
+        std::deque<std::function<void()>> background;
+        //only when there are no workers, runs nothing but background tasks
+        std::thread backgroundThread;
+
+        std::mutex sleepMutex;
+        std::condition_variable wake;
+        int pending = 0;
+        bool stopping = false;
+        std::atomic<unsigned> nextQueue{0};
+
+        //index of the worker running on this thread, -1 for threads that don't belong to this pool
+        int currentWorker() const {
+            return workerOwner() == this ? workerId() : -1;
+        }
+
+        static const ThreadPool*& workerOwner(){
+            static thread_local const ThreadPool* owner = nullptr;
+            return owner;
+        }
+
+        static int& workerId(){
+            static thread_local int id = -1;
+            return id;
+        }
+
+        //pops from our own deque first, otherwise steals from the others, and only then
+        //(if allowed) takes a background task
+        bool runOne(int self, bool allowBackground){
+
+            std::function<void()> task;
+            const int n = (int)queues.size();
+
+            if(self >= 0){
+                std::lock_guard<std::mutex> lock(queues[self]->mutex);
+                if(!queues[self]->tasks.empty()){
+                    task = std::move(queues[self]->tasks.back());
+                    queues[self]->tasks.pop_back();
+                }
+            }
+
+            for(int k = 1; !task && k <= n; k++){
+                int victim = ((self >= 0 ? self : 0) + k) % n;
+                std::lock_guard<std::mutex> lock(queues[victim]->mutex);
+                if(!queues[victim]->tasks.empty()){
+                    task = std::move(queues[victim]->tasks.front());
+                    queues[victim]->tasks.pop_front();
+                }
+            }
+
+            if(!task && allowBackground){
+                std::lock_guard<std::mutex> lock(backgroundMutex);
+                if(!background.empty()){
+                    task = std::move(background.front());
+                    background.pop_front();
+                }
+            }
+
+            if(!task)
+                return false;
+
+            {
+                std::lock_guard<std::mutex> lock(sleepMutex);
+                pending--;
+            }
+            task();
+            return true;
+        }
+
+        void workerLoop(int id){
+
+            workerOwner() = this;
+            workerId() = id;
+
+            while(true){
+
+                if(runOne(id, true))
+                    continue;
+
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                wake.wait(lock, [this]{ return stopping || pending > 0; });
+                if(stopping && pending == 0)
+                    return;
+            }
+        }
+
+        //without workers submit() and parallelFor run inline, so background tasks are all that is ever pending
+        void backgroundLoop(){
+
+            while(true){
+
+                if(runOne(-1, true))
+                    continue;
+
+                std::unique_lock<std::mutex> lock(sleepMutex);
+                wake.wait(lock, [this]{ return stopping || pending > 0; });
+                if(stopping && pending == 0)
+                    return;
+            }
+        }
+};
+
+//process-wide pool, created on first use
+inline ThreadPool& workerPool(){
+    static ThreadPool pool;
+    return pool;
+}
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+
+#include "glad/glad.h"
+#include <glm/glm.hpp>
+
+//Helpers for the packed vertex layouts.
+//Normals go out octahedral-encoded in two snorm16s (the unit sphere folded onto a square),
+//texture coordinates as half floats or unorm16, and indices as 16-bit whenever the vertex count fits.
+//The shaders undo the normal encoding with
+//
+//  vec3 octDecode(vec2 e){
+//      vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+//      float t = max(-n.z, 0.0);
+//      n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+//      return normalize(n);
+//  }
+
+inline int16_t packSnorm16(float value){
+    return (int16_t)std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f);
+}
+
+inline uint16_t packUnorm16(float value){
+    return (uint16_t)std::lround(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f);
+}
+
+//IEEE binary16, round to nearest even; out of range becomes infinity, tiny values denormals or zero
+inline uint16_t packHalf(float value){
+
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t mantissa = bits & 0x7fffff;
+    int exponent = (int)((bits >> 23) & 0xff);
+
+    //infinity, NaN
+    if(exponent == 0xff)
+        return (uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0));
+
+    exponent = exponent - 127 + 15;
+    if(exponent >= 31)
+        return (uint16_t)(sign | 0x7c00);
+
+    if(exponent <= 0){
+        if(exponent < -10)
+            return (uint16_t)sign;
+        mantissa |= 0x800000;
+        uint32_t shift = (uint32_t)(14 - exponent);
+        uint32_t half = mantissa >> shift;
+        uint32_t rest = mantissa & ((1u << shift) - 1), midpoint = 1u << (shift - 1);
+        if(rest > midpoint || (rest == midpoint && (half & 1)))
+            half++;
+        return (uint16_t)(sign | half);
+    }
+
+    uint32_t half = sign | ((uint32_t)exponent << 10) | (mantissa >> 13);
+    uint32_t rest = mantissa & 0x1fff;
+    //a carry out of the mantissa correctly bumps the exponent
+    if(rest > 0x1000 || (rest == 0x1000 && (half & 1)))
+        half++;
+    return (uint16_t)half;
+}
+
+//a zero vector comes out as +z
+inline void packOctahedral(glm::vec3 normal, int16_t out[2]){
+
+    float sum = std::abs(normal.x) + std::abs(normal.y) + std::abs(normal.z);
+    if(sum == 0.0f){
+        out[0] = out[1] = 0;
+        return;
+    }
+
+    float x = normal.x / sum, y = normal.y / sum;
+    //the lower half folds over the diagonals
+    if(normal.z < 0.0f){
+        float foldedX = (1.0f - std::abs(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        float foldedY = (1.0f - std::abs(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = foldedX;
+        y = foldedY;
+    }
+    out[0] = packSnorm16(x);
+    out[1] = packSnorm16(y);
+}
+
+//the narrowest index type that can address 'vertexCount' vertices
+inline GLenum indexTypeFor(size_t vertexCount){
+    return vertexCount <= 65536 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+}
+
+inline size_t indexSize(GLenum indexType){
+    return indexType == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+#endif
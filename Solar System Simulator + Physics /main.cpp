@@ -1,23 +1,34 @@
 #include <iostream>
 #include  <memory>
+#include <cstring>
 
 
 #include "SHADER.h"
 #include "CAMERA.h"
 #include "CELESTIAL_OBJECTS.h"
 #include "ASSIMP.h"
+#include "PHYSICS.h"
+#include "BARNES_HUT.h"
+#include "INSTANCING.h"
+#include "FRAME_UNIFORMS.h"
+#include "DEPTH.h"
+#include "GPU_TIMER.h"
 
 const unsigned int WIDTH = 1280;
 const unsigned int HEIGHT = 800;
 
 
-Camera camera(glm::vec3(0.0f, 20.0f, -10000.0f));
+Camera camera(glm::dvec3(0.0, 20.0, -10000.0));
 
 float lastX = WIDTH / 2.0f;
 float lastY = HEIGHT / 2.0f;
 bool firstMouse = true;
 bool pause = true;
 bool spacePressedLastFrame = false;
+bool useBarnesHut = false;
+bool bPressedLastFrame = false;
+IntegratorType integrator = IntegratorType::LEAPFROG;
+bool iPressedLastFrame = false;
 
 
 float constant = 1.0f;
@@ -26,13 +37,23 @@ float linear = 0.00045f;
 //timing
 float deltaTime = 0.0f;
 
+//in pixels, which on high-DPI screens isn't the window size; kept current by the resize callback
+int framebufferWidth = WIDTH;
+int framebufferHeight = HEIGHT;
+
 void framebuffer_size_callback(GLFWwindow *window, int width, int height){
     glViewport(0, 0, width, height);
+    depthBuffer().resize(width, height);
+    //minimized, keep the last size so the aspect and pixel scale stay finite
+    if(width > 0 && height > 0){
+        framebufferWidth = width;
+        framebufferHeight = height;
+    }
 }
 
 bool altPressed = false;
 bool altPressedLastFrame = false;
-glm::vec3 shipPosition;
+glm::dvec3 shipPosition;
 float orbitDistance = 100.0f;
 float orbitAngle = 0.0f;
 
@@ -46,6 +67,20 @@ void processInput(GLFWwindow *window){
     }
     spacePressedLastFrame = spacePressed;
 
+    bool bPressed = glfwGetKey(window, GLFW_KEY_B) == GLFW_PRESS;
+    if(bPressed && !bPressedLastFrame){
+        useBarnesHut = !useBarnesHut;
+    }
+    bPressedLastFrame = bPressed;
+
+    //cycle leapfrog -> yoshida-4 -> wisdom-holman
+    bool iPressed = glfwGetKey(window, GLFW_KEY_I) == GLFW_PRESS;
+    if(iPressed && !iPressedLastFrame){
+        integrator = (IntegratorType)(((int)integrator + 1) % INTEGRATOR_COUNT);
+        std::cout << "INTEGRATOR: " << integratorName(integrator) << "\n";
+    }
+    iPressedLastFrame = iPressed;
+
     if(glfwGetKey(window, GLFW_KEY_L) == GLFW_PRESS)
         glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
     if(glfwGetKey(window, GLFW_KEY_F) == GLFW_PRESS)
@@ -71,8 +106,8 @@ void processInput(GLFWwindow *window){
     }
     altPressed = glfwGetKey(window, GLFW_KEY_LEFT_ALT) == GLFW_PRESS;
     if(altPressed && !altPressedLastFrame){
-        shipPosition = camera.Position + camera.Front * 100.0f + camera.Up * -10.0f;
-        orbitDistance = glm::distance(camera.Position, shipPosition);
+        shipPosition = camera.Position + glm::dvec3(camera.Front * 100.0f + camera.Up * -10.0f);
+        orbitDistance = (float)glm::distance(camera.Position, shipPosition);
     }
     altPressedLastFrame = altPressed;
 
@@ -143,13 +178,73 @@ GLFWwindow* STARTGLFW(){
     return window;
 }
 
-int main(){
+int main(int argc, char** argv){
+
+    //./main --bench-gravity times the scalar/AVX2/AVX-512 gravity kernels and exits
+    if(argc > 1 && std::strcmp(argv[1], "--bench-gravity") == 0){
+        benchmarkGravityKernels();
+        return 0;
+    }
+
+    //./main --bench-rails times a frame of test particles on Kepler rails against integrating them
+    if(argc > 1 && std::strcmp(argv[1], "--bench-rails") == 0){
+        benchmarkKeplerRails();
+        return 0;
+    }
+
+    //--compress-textures stores body textures as BC1 when the GPU has S3TC,
+    //--impostors draws the bodies as ray-traced spheres instead of meshes,
+    //--reversed-z / --log-depth pick the depth buffer mode (DEPTH.h),
+    //--inverse-normals goes back to inverting the model matrix per vertex, to time against,
+    //--vertex-only turns rasterization off around the timed draws so only the vertex work is measured (nothing is shown)
+    bool compressTextures = false;
+    bool impostors = false;
+    DepthMode depthMode = DepthMode::STANDARD;
+    bool inverseNormals = false;
+    bool vertexOnly = false;
+    for(int i = 1; i < argc; i++){
+        if(std::strcmp(argv[i], "--compress-textures") == 0)
+            compressTextures = true;
+        if(std::strcmp(argv[i], "--impostors") == 0)
+            impostors = true;
+        if(std::strcmp(argv[i], "--reversed-z") == 0)
+            depthMode = DepthMode::REVERSED_Z;
+        if(std::strcmp(argv[i], "--log-depth") == 0)
+            depthMode = DepthMode::LOGARITHMIC;
+        if(std::strcmp(argv[i], "--inverse-normals") == 0)
+            inverseNormals = true;
+        if(std::strcmp(argv[i], "--vertex-only") == 0)
+            vertexOnly = true;
+    }
+
+    //./main --bake-textures [--compress-textures] textures/*.png fills the texture cache offline and exits
+    if(argc > 1 && std::strcmp(argv[1], "--bake-textures") == 0){
+        for(int i = 2; i < argc; i++)
+            if(std::strcmp(argv[i], "--compress-textures") != 0)
+                bakeTexture(argv[i], compressTextures);
+        return 0;
+    }
     
     STARTGLFW();
 
+    if(compressTextures)
+        bodyTextures().enableCompression();
+
+    std::cout << "GRAVITY KERNEL: " << gravityKernels().name << "\n";
+    std::cout << "SIMULATION THREADS: " << workerPool().size() + 1 << "\n";
+
     std::vector<std::unique_ptr<CelestialBody>> celestialBodies;
+    NBodySystem physics;
+    bool solverIsBarnesHut = false;
 
     glEnable(GL_DEPTH_TEST);
+
+    //before any shader is compiled
+    glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+    depthBuffer().setup(depthMode, framebufferWidth, framebufferHeight);
+    std::cout << "DEPTH BUFFER: " << depthBuffer().name() << "\n";
+    if(inverseNormals)
+        shaderDefines() += "#define INVERSE_NORMALS\n";
     glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 
     float simulationTime = 0.0f;
@@ -158,6 +253,11 @@ int main(){
     Shader planetShader("SHADERS/vertexShader_Planet.glsl", "SHADERS/fragmentShader_Planet.glsl");
     Shader starShader("SHADERS/vertexShader_Stars.glsl", "SHADERS/fragmentShader_Stars.glsl");
     Shader moonShader("SHADERS/vertexShader_moon.glsl", "SHADERS/fragmentShader_moon.glsl");
+
+    //the same lighting traced on a quad per body
+    Shader planetImpostorShader("SHADERS/vertexShader_Impostor.glsl", "SHADERS/fragmentShader_Planet.glsl", "SHADERS/impostor.glsl");
+    Shader starImpostorShader("SHADERS/vertexShader_Impostor.glsl", "SHADERS/fragmentShader_Stars.glsl", "SHADERS/impostor.glsl");
+    Shader moonImpostorShader("SHADERS/vertexShader_Impostor.glsl", "SHADERS/fragmentShader_moon.glsl", "SHADERS/impostor.glsl");
     
     Shader shipShader("SHADERS/vertexShader_model.glsl", "SHADERS/fragmentShader_model.glsl");
     Model shipModel("models/ship.obj");
@@ -165,16 +265,20 @@ int main(){
     //Star
     glm::vec3 sunPos = glm::vec3(0.0f, 0.0f, 0.0f);
     float sunScale = 3000.0f;
+    //picked so a circular orbit at earth's distance (15000) takes the old 0.07 rad/s
+    float sunMass = 1.65e10f;
     celestialBodies.push_back(std::make_unique<Star>(
     starShader,
     sunPos,
     "textures/sun.png",
     sunScale
 ));
+    int sunBody = physics.addBody(sunMass, sunScale, sunPos, glm::vec3(0.0f));
+    celestialBodies.back()->attachBody(&physics.bodies, sunBody);
 
     //mercury
     float mercury_orbitRadius = 5000.0f;
-    float mercury_orbitSpeed = 0.05f;
+    float mercury_mass = 2.7e3f;
     float mercury_spinSpeed = 0.5f;
     
 
@@ -189,19 +293,18 @@ int main(){
             planetShader,
             mercuryPos,
             "textures/mercury.jpg",
-            mercury_orbitSpeed,
             mercury_spinSpeed,
             mercury_axialTilt,
             mercury_scale,
-            sunPos,
-            camera.Position,
             constant,
             linear,
             mercury_quadratic
                 ));
+    int mercuryBody = physics.addOrbitingBody(mercury_mass, mercury_scale, sunBody, mercuryPos - sunPos);
+    celestialBodies.back()->attachBody(&physics.bodies, mercuryBody);
     //vemus
     float venus_orbitRadius = 10000.0f;
-    float venus_orbitSpeed = 0.06f;
+    float venus_mass = 2.4e4f;
     float venus_spinSpeed = 0.6f;
     
     float venus_axialTilt = 177.36f;
@@ -215,20 +318,20 @@ int main(){
         planetShader,
         venusPos,
         "textures/venus.jpg",
-        venus_orbitSpeed,
         venus_spinSpeed,
         venus_axialTilt,
         venus_scale,
-        sunPos,
-        camera.Position,
         constant,
         linear,
         venus_quadratic
     ));
+    int venusBody = physics.addOrbitingBody(venus_mass, venus_scale, sunBody, venusPos - sunPos);
+    celestialBodies.back()->attachBody(&physics.bodies, venusBody);
 
     //earth
     float earth_orbitRadius = 15000.0f;
-    float earth_orbitSpeed = 0.07f;
+    //far heavier than the real ratio so the moon stays well inside earth's Hill sphere
+    float earth_mass = 1.0e7f;
     float earth_spinSpeed = 0.7f;
     float axialTilt = glm::radians(23.5f);
     float earthScale = 10.0f * 20;
@@ -240,20 +343,19 @@ int main(){
        planetShader,
        earthPos,
        "textures/earth.png",
-       earth_orbitSpeed,
        earth_spinSpeed,
        axialTilt,
        earthScale,
-       sunPos,
-       camera.Position,
        constant,
        linear,
        quadratic
     ));
+    int earthBody = physics.addOrbitingBody(earth_mass, earthScale, sunBody, earthPos - sunPos);
+    celestialBodies.back()->attachBody(&physics.bodies, earthBody);
 
-    float moonDistanceFromEarth = 500.0f;
+    float moonDistanceFromEarth = 350.0f;
     float moonScale = 1.0f * 20.0f;
-    float moon_OrbitSpeed = 0.27f;
+    float moonMass = 0.0123f * earth_mass;
     
     float axialTiltMoon = glm::radians(5.0f);
 
@@ -264,20 +366,19 @@ int main(){
         moonShader,
         glm::vec3(moonDistanceFromEarth, 0.0f, 0.0f),
         "textures/moon.jpg",
-        moon_OrbitSpeed,
         axialTiltMoon,
         moonScale,
-        earthPos,
-        camera.Position,
         celestialBodies[3].get(),
         constant,
         linear,
         moonQuadratic
     ));   
+    int moonBody = physics.addOrbitingBody(moonMass, moonScale, earthBody, glm::vec3(moonDistanceFromEarth, 0.0f, 0.0f));
+    celestialBodies.back()->attachBody(&physics.bodies, moonBody);
     
     //mars
     float mars_orbitRadius = 20000.0f;
-    float mars_orbitSpeed = 0.08f;
+    float mars_mass = 5.3e3f;
     float mars_spinSpeed = 0.8f;
     float mars_axialTilt = glm::radians(25.5f);
     float marsScale = 5.3f * 20.0f;
@@ -290,20 +391,20 @@ int main(){
         planetShader,
         marsPos,
         "textures/mars.jpg",
-        mars_orbitSpeed,
         mars_spinSpeed,
         mars_axialTilt,
         marsScale,
-        sunPos,
-        camera.Position,
         constant,
         linear,
         mars_quadratic
     ));
+    int marsBody = physics.addOrbitingBody(mars_mass, marsScale, sunBody, marsPos - sunPos);
+    celestialBodies.back()->attachBody(&physics.bodies, marsBody);
     
     //jupiter
     float jupiter_orbitRadius = 25000.0f;
-    float jupiter_orbitSpeed = 0.09f;
+    //kept light, a real jupiter/sun ratio this close to mars makes mars' orbit unstable
+    float jupiter_mass = 5.0e6f;
     float jupiter_spinSpeed = 0.9f;
 
     float jupiter_axialTilt = glm::radians(3.13);
@@ -317,19 +418,18 @@ int main(){
         planetShader,
         jupiterPos,
         "textures/jupiter.jpg",
-        jupiter_orbitSpeed,
         jupiter_spinSpeed,
         jupiter_axialTilt,
         jupiterScale,
-        sunPos,
-        camera.Position,
         constant,
         linear,
         jupiter_quadratic
     ));
+    int jupiterBody = physics.addOrbitingBody(jupiter_mass, jupiterScale, sunBody, jupiterPos - sunPos);
+    celestialBodies.back()->attachBody(&physics.bodies, jupiterBody);
     
     float planetX_orbitRadius = 30000.0f;
-    float planetX_orbitSpeed = 0.1f;
+    float planetX_mass = 5.0e4f;
     float planetX_spinSpeed = 1.0f;
     
     float planetX_axialTilt = glm::radians(0.0f);
@@ -343,16 +443,55 @@ int main(){
         planetShader,
         planetXpos,
         "textures/planetX.jpg",
-        planetX_orbitSpeed,
         planetX_spinSpeed,
         planetX_axialTilt,
         planetXScale,
-        sunPos,
-        camera.Position,
         constant,
         linear,
         planetX_quadratic
     ));
+    int planetXBody = physics.addOrbitingBody(planetX_mass, planetXScale, sunBody, planetXpos - sunPos);
+    celestialBodies.back()->attachBody(&physics.bodies, planetXBody);
+
+    physics.removeNetMomentum();
+
+    //every body has its layer by now, the arrays fill in the background while the first frames render
+    bodyTextures().load();
+
+    //resolved once, the loop below sets it without any string lookups
+    Uniform<glm::mat4> shipModelMatrix = shipShader.uniform<glm::mat4>("model");
+    Uniform<glm::mat3> shipNormalMatrix = shipShader.uniform<glm::mat3>("normalMatrix");
+
+    //the ship's light never changes, set it once
+    shipShader.use();
+    shipShader.setVec3("dirLight.direction", sunPos);
+    shipShader.setVec3("dirLight.ambient",  glm::vec3(0.4));
+    shipShader.setVec3("dirLight.diffuse",  glm::vec3(1.0f));
+    shipShader.setVec3("dirLight.specular", glm::vec3(1.0f));
+
+    // Material shininess
+    shipShader.setFloat("material.shininess", 32.0f);
+
+    //view, projection and lighting for every shader, written once per frame
+    FrameUniforms frameUniforms;
+
+    //same order as created, planets before their moons
+    InstancedRenderer renderer;
+    renderer.setImpostorShader(planetShader, planetImpostorShader);
+    renderer.setImpostorShader(starShader, starImpostorShader);
+    renderer.setImpostorShader(moonShader, moonImpostorShader);
+    renderer.impostors = impostors;
+    std::cout << "SPHERES: " << (impostors ? "RAY-TRACED IMPOSTORS" : "MESHES") << "\n";
+    for(auto &obj: celestialBodies)
+        renderer.add(obj.get());
+
+    //by-name uniform lookups per frame, printed whenever the number changes
+    int lastUniformLookups = -1;
+    //bodies drawn and culled, printed whenever they change
+    int lastDrawn = -1, lastCulled = -1, lastPoints = -1;
+    //GPU time of the bodies and the ship, where the normal matrix cost shows up; averaged and printed every 120 frames
+    GpuTimer sceneTimer;
+    uniformLookups() = 0;
     
     while(!glfwWindowShouldClose(window)){
         
@@ -363,55 +502,68 @@ int main(){
         float FPS = 1.0f / deltaTime;
 
         glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        depthBuffer().beginFrame();
+
+        if(useBarnesHut != solverIsBarnesHut){
+            if(useBarnesHut)
+                physics.setSolver(std::make_unique<BarnesHutSolver>(0.5f));
+            else
+                physics.setSolver(std::make_unique<DirectSolver>());
+            solverIsBarnesHut = useBarnesHut;
+            std::cout << "GRAVITY SOLVER: " << (useBarnesHut ? "BARNES-HUT" : "DIRECT") << "\n";
+        }
+
+        physics.integrator = integrator;
 
+        //physics runs in fixed steps, rendering blends between the last two
         if(!pause)
-            simulationTime += deltaTime;
+            physics.advance(deltaTime);
+        simulationTime = (float)physics.renderTime();
 
 
-        float znear = 0.1f;
-        float zfar  = 3000000000.0f;
+        //camera-relative: the view has no translation, every model is placed at (position - camera.Position)
         glm::mat4 view = camera.GetViewMatrix();
-        glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom), (float)WIDTH / (float)HEIGHT, znear, zfar);
+        glm::mat4 projection = depthBuffer().projection(glm::radians(camera.Zoom), (float)framebufferWidth / (float)framebufferHeight);
+
+        FrameData frame;
+        frame.view = view;
+        frame.projection = projection;
+        //every body is lit by the star where the simulation has it now
+        frame.lightPos = glm::vec4(camera.RelativePosition(physics.bodies.renderPosition(sunBody)), 1.0f);
+        frame.viewPos = glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+        frameUniforms.update(frame);
         
-        for(auto &obj: celestialBodies){
-            obj->Draw(view, projection, simulationTime);
-        }
+        //textures decoded since last frame
+        assetLoader().pump();
+
+        if(vertexOnly)
+            glEnable(GL_RASTERIZER_DISCARD);
+        sceneTimer.begin();
+        renderer.draw(simulationTime, camera.Position, view, projection, (float)framebufferHeight);
         
         shipShader.use();
-        shipShader.setMat4("view", view);
-        shipShader.setMat4("projection", projection);
-
-
-        shipShader.setVec3("dirLight.direction", sunPos);
-        shipShader.setVec3("dirLight.ambient",  glm::vec3(0.4));
-        shipShader.setVec3("dirLight.diffuse",  glm::vec3(1.0f));
-        shipShader.setVec3("dirLight.specular", glm::vec3(1.0f));
-
-        // Material shininess
-        shipShader.setFloat("material.shininess", 32.0f);
         
         if(altPressed){
             orbitAngle += 0.5f * deltaTime;
 
-            float x = shipPosition.x + orbitDistance * cos(orbitAngle);
-            float z = shipPosition.z + orbitDistance * sin(orbitAngle);
+            double x = shipPosition.x + orbitDistance * cos(orbitAngle);
+            double z = shipPosition.z + orbitDistance * sin(orbitAngle);
 
-            camera.Position = glm::vec3(x, shipPosition.y + 20.0f, z);
+            camera.Position = glm::dvec3(x, shipPosition.y + 20.0, z);
 
-            camera.Front = glm::normalize(shipPosition - camera.Position);
+            camera.Front = glm::normalize(camera.RelativePosition(shipPosition));
             camera.Right = glm::normalize(glm::cross(camera.Front, glm::vec3(0.0f, 1.0f, 0.0f)));
             camera.Up = glm::normalize(glm::cross(camera.Right, camera.Front));
         }
         else{
-            shipPosition = camera.Position + camera.Front * 100.0f + camera.Up * -10.0f;
+            shipPosition = camera.Position + glm::dvec3(camera.Front * 100.0f + camera.Up * -10.0f);
 //            camera.Position = shipPosition - camera.Front * 10.0f;
         }
 
         glm::mat4 model = glm::mat4(1.0f);
         
-        // Offset the ship a bit in front of the camera
-        model = glm::translate(model, camera.Position + camera.Front * 100.0f + camera.Up *  -10.0f);
+        // Offset the ship a bit in front of the camera, which is the origin of render space
+        model = glm::translate(model, camera.Front * 100.0f + camera.Up *  -10.0f);
         //Rotate the ship to match the camera orientation
         model = glm::rotate(model, glm::radians(-camera.Yaw), glm::vec3(0.0f, 1.0f, 0.0f));
         model = glm::rotate(model, glm::radians(-camera.Pitch), glm::vec3(1.0f, 0.0f, 0.0f));
@@ -419,12 +571,38 @@ int main(){
         //scale the ship down
         model = glm::scale(model, glm::vec3(1.0f));
         
-        shipShader.setMat4("model", model);
+        shipShader.set(shipModelMatrix, model);
+        //rotations and a uniform scale only, so the model matrix transforms normals as it is (the fragment shader normalizes)
+        shipShader.set(shipNormalMatrix, glm::mat3(model));
 
         shipModel.Draw(shipShader);
+        sceneTimer.end();
+        if(vertexOnly)
+            glDisable(GL_RASTERIZER_DISCARD);
+        frameUniforms.endFrame();
+
+        if(uniformLookups() != lastUniformLookups){
+            lastUniformLookups = uniformLookups();
+            std::cout << "UNIFORM LOOKUPS/FRAME: " << lastUniformLookups << "\n";
+        }
+        uniformLookups() = 0;
+
+        if(renderer.culler.drawn != lastDrawn || renderer.culler.culled != lastCulled || renderer.points != lastPoints){
+            lastDrawn = renderer.culler.drawn;
+            lastCulled = renderer.culler.culled;
+            lastPoints = renderer.points;
+            std::cout << "BODIES DRAWN: " << lastDrawn << " CULLED: " << lastCulled
+                      << " AS POINTS: " << lastPoints << " SPHERE TRIANGLES: " << renderer.triangles << "\n";
+        }
+
+        double sceneMilliseconds;
+        if(sceneTimer.ready(sceneMilliseconds))
+            std::cout << (vertexOnly ? "SCENE GPU TIME (VERTEX ONLY): " : "SCENE GPU TIME: ") << sceneMilliseconds << " MS (NORMALS: "
+                      << (inverseNormals ? "PER-VERTEX INVERSE" : "PRECOMPUTED") << ")\n";
 
         processInput(window);
 
+        depthBuffer().endFrame();
         glfwSwapBuffers(window);
         glfwPollEvents();
     }